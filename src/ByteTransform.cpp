@@ -0,0 +1,114 @@
+#include <string.h>
+
+#include "ByteTransform.h"
+
+// SWAR byte tests on a 32 bit word, see "Bit Twiddling Hacks"
+static constexpr uint32_t kOnes = 0x01010101u;
+static constexpr uint32_t kHighs = 0x80808080u;
+
+static inline uint32_t broadcast(uint8_t b) { return kOnes * b; }
+static inline bool hasZero(uint32_t w) { return ((w - kOnes) & ~w & kHighs) != 0; }
+// any byte < n, 0 < n <= 128
+static inline bool hasLess(uint32_t w, uint32_t nWord) { return ((w - nWord) & ~w & kHighs) != 0; }
+// any byte > n, n <= 127, nWord holds 127 - n
+static inline bool hasMore(uint32_t w, uint32_t nWord) { return (((w + nWord) | w) & kHighs) != 0; }
+
+void ByteTransform::configure(uint8_t flags)
+{
+  m_flags = flags & ALL;
+  m_maxExpansion = 1;
+
+  for (int i = 0; i < 256; ++i) {
+    Entry& e = m_lut[i];
+    uint8_t b = (uint8_t)i;
+    e.len = 1;
+    e.out[0] = b;
+
+    if (m_flags & MASK_7BIT) e.out[0] = b = b & 0x7F;
+    if ((m_flags & STRIP_CONTROL) && (b < 0x20 || b > 0x7E) && b != '\t' && b != '\r' && b != '\n') e.len = 0;
+    if ((m_flags & CRLF_TO_LF) && b == '\r') e.len = 0;
+    if (e.len && (m_flags & LF_TO_CRLF) && b == '\n') { e.len = 2; e.out[0] = '\r'; e.out[1] = '\n'; }
+    if (e.len && (m_flags & DLE_ESCAPE) && b == 0x10) { e.len = 2; e.out[1] = 0x10; }
+
+    if (e.len > m_maxExpansion) m_maxExpansion = e.len;
+  }
+
+  buildFastPath();
+}
+
+void ByteTransform::buildFastPath()
+{
+  auto same = [this](int b) { return m_lut[b].len == 1 && m_lut[b].out[0] == b; };
+
+  // grow a run of unchanged bytes around 'A', stepping over a few single byte holes
+  m_fastPath = same('A');
+  if (!m_fastPath) return;
+
+  int lo = 'A', hi = 'A';
+  uint8_t holes[kMaxHoles];
+  uint8_t holeCount = 0;
+  for (;;) {
+    if (hi < 255 && same(hi + 1)) { hi++; continue; }
+    if (lo > 0 && same(lo - 1)) { lo--; continue; }
+    if (holeCount < kMaxHoles && hi < 254 && same(hi + 2)) { holes[holeCount++] = hi + 1; hi += 2; continue; }
+    if (holeCount < kMaxHoles && lo > 1 && same(lo - 2)) { holes[holeCount++] = lo - 1; lo -= 2; continue; }
+    break;
+  }
+
+  // the word tests only bound from above below 128, shrink to what they can check
+  if (hi != 255 && hi > 127) hi = 127;
+
+  m_checkLo = lo > 0;
+  m_checkHi = hi < 255;
+  m_loWord = broadcast((uint8_t)lo);
+  m_hiWord = broadcast((uint8_t)(127 - (hi < 127 ? hi : 127)));
+  m_holeCount = 0;
+  for (uint8_t i = 0; i < holeCount; ++i) {
+    if (holes[i] >= lo && holes[i] <= hi) m_holeWords[m_holeCount++] = broadcast(holes[i]);
+  }
+}
+
+inline bool ByteTransform::passes(uint32_t word) const
+{
+  if (m_checkLo && hasLess(word, m_loWord)) return false;
+  if (m_checkHi && hasMore(word, m_hiWord)) return false;
+  for (uint8_t i = 0; i < m_holeCount; ++i) {
+    if (hasZero(word ^ m_holeWords[i])) return false;
+  }
+  return true;
+}
+
+size_t ByteTransform::apply(uint8_t* buf, size_t offset, size_t len) const
+{
+  const uint8_t* in = buf + offset;
+  const uint8_t* end = in + len;
+  uint8_t* out = buf;
+
+  if (identity()) {
+    if (offset) memmove(buf, in, len);
+    return len;
+  }
+
+  while (in < end) {
+    // unchanged words are copied whole, or skipped while nothing has moved yet
+    if (m_fastPath) {
+      while (end - in >= 4) {
+        uint32_t word;
+        memcpy(&word, in, 4);
+        if (!passes(word)) break;
+        if (out != in) memcpy(out, &word, 4);
+        out += 4;
+        in += 4;
+      }
+    }
+
+    // look up the next word's worth, the output never overtakes unread input
+    const uint8_t* stop = (end - in > 4) ? in + 4 : end;
+    while (in < stop) {
+      const Entry& e = m_lut[*in++];
+      for (uint8_t i = 0; i < e.len; ++i) *out++ = e.out[i];
+    }
+  }
+
+  return (size_t)(out - buf);
+}
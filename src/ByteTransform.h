@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Stateless byte transforms compiled into a 256 entry lookup table. Plain C++
+// with no Arduino dependencies.
+//
+// Bytes that map to themselves are the common case, the table records the
+// range they fall in (plus a couple of holes) so apply() can skip over them a
+// 32 bit word at a time and only look up the rest.
+
+class ByteTransform {
+  public:
+    // applied in this order, each one sees the output of the previous
+    enum Flag : uint8_t {
+      MASK_7BIT      = 0x01,  // clear bit 7
+      STRIP_CONTROL  = 0x02,  // drop non printables except tab, cr and lf
+      CRLF_TO_LF     = 0x04,  // drop cr
+      LF_TO_CRLF     = 0x08,  // lf becomes cr lf
+      DLE_ESCAPE     = 0x10,  // dle becomes dle dle
+      ALL            = 0x1F
+    };
+
+    ByteTransform() { configure(0); }
+
+    void configure(uint8_t flags);
+    uint8_t flags() const { return m_flags; }
+    bool identity() const { return m_flags == 0; }
+
+    // raw input goes at buf + inputOffset(cap), at most inputCap(cap) bytes,
+    // so apply() can grow it in place without overtaking unread input
+    size_t inputCap(size_t cap) const { return cap / m_maxExpansion; }
+    size_t inputOffset(size_t cap) const { return m_maxExpansion == 1 ? 0 : cap - inputCap(cap); }
+
+    // transforms len bytes at buf + offset, the result starts at buf, returns its length
+    size_t apply(uint8_t* buf, size_t offset, size_t len) const;
+
+  private:
+    static constexpr uint8_t kMaxHoles = 2;
+
+    // 4 byte entries, up to 3 output bytes
+    struct Entry {
+      uint8_t len;
+      uint8_t out[3];
+    };
+
+    uint8_t m_flags = 0;
+    uint8_t m_maxExpansion = 1;
+    Entry m_lut[256];
+
+    // word fast path: every byte in [lo, hi] except the holes maps to itself
+    bool m_fastPath = false;
+    bool m_checkLo = false;
+    bool m_checkHi = false;
+    uint32_t m_loWord = 0;
+    uint32_t m_hiWord = 0;
+    uint8_t m_holeCount = 0;
+    uint32_t m_holeWords[kMaxHoles] = {};
+
+    bool passes(uint32_t word) const;
+    void buildFastPath();
+};
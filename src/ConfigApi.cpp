@@ -0,0 +1,373 @@
+#include <Arduino.h>
+#include <algorithm>
+#include <ArduinoJson.h>
+#include <ArduinoLog.h>
+#include <ESPAsyncWebServer.h>
+
+#include "ConfigApi.h"
+#include "SerialBridge.h"
+#include "WifiManager.h"
+#include "Trace.h"
+
+static constexpr size_t kMaxBody = 4096;
+
+// validated input, nothing is applied until the whole request checks out
+struct BridgeInput {
+  SerialBridge* bridge;
+  SerialBridge::BridgeType type;
+  String host;
+  ushort port;
+  unsigned long baud;
+  SerialBridge::SerialFormat fmt;
+  bool hasEcho;
+  bool simulateEcho;
+  bool rfc2217;
+  bool hasRs485;
+  bool rs485;
+  int8_t dePin;
+  bool hasTransforms;
+  uint8_t transformsRx;
+  uint8_t transformsTx;
+  bool hasQos;
+  SerialBridge::QosClass qos;
+  uint32_t rateLimit;
+};
+
+struct WifiInput {
+  String ssid;
+  String pass;
+  String hostname;
+  bool staticIp;
+  IPAddress ip, gw, mask, dns;
+  bool fastIp;
+  bool roam;
+};
+
+static void bridgeToJson(SerialBridge* bridge, JsonObject obj)
+{
+  obj["code"] = bridge->code();
+  obj["name"] = bridge->name();
+  obj["type"] = SerialBridge::toString(bridge->type());
+  obj["host"] = bridge->host();
+  obj["port"] = bridge->port();
+  obj["baud"] = bridge->baud();
+  obj["format"] = SerialBridge::toString(bridge->format());
+  obj["hasEcho"] = bridge->hasEcho();
+  obj["simulateEcho"] = bridge->simulateEcho();
+  obj["rfc2217"] = bridge->rfc2217();
+  if (bridge->isUart()) {
+    obj["rs485"] = bridge->rs485();
+    obj["dePin"] = bridge->rs485DePin();
+  }
+  obj["transformsRx"] = bridge->transforms(SerialBridge::Direction::SERIAL_TO_LINK);
+  obj["transformsTx"] = bridge->transforms(SerialBridge::Direction::LINK_TO_SERIAL);
+  obj["qos"] = SerialBridge::toString(bridge->qos());
+  obj["rateLimit"] = bridge->rateLimit();
+}
+
+// fields of the wrong json type would silently fall back to the current value with `|`
+static const char* const kBridgeStrings[] = { "type", "format", "host", "qos" };
+static const char* const kBridgeNumbers[] = { "port", "baud", "dePin", "transformsRx", "transformsTx", "rateLimit" };
+static const char* const kBridgeBools[] = { "hasEcho", "simulateEcho", "rfc2217", "rs485" };
+static const char* const kWifiStrings[] = { "ssid", "password", "hostname", "ip", "gateway", "mask", "dns" };
+static const char* const kWifiBools[] = { "staticIp", "fastIp", "roam" };
+
+template <typename T, size_t N>
+static bool checkTypes(JsonObjectConst obj, const char* const (&keys)[N], const char* what, const String& prefix, String* error)
+{
+  for (const char* key : keys) {
+    if (obj[key].isNull() || obj[key].is<T>()) continue;
+    *error = prefix + ": " + key + " must be " + what;
+    return false;
+  }
+  return true;
+}
+
+static bool bridgeFromJson(SerialBridge* bridge, JsonObjectConst obj, BridgeInput* in, String* error)
+{
+  in->bridge = bridge;
+
+  if (!checkTypes<const char*>(obj, kBridgeStrings, "a string", bridge->code(), error) ||
+      !checkTypes<long>(obj, kBridgeNumbers, "an integer", bridge->code(), error) ||
+      !checkTypes<bool>(obj, kBridgeBools, "a boolean", bridge->code(), error)) return false;
+
+  in->type = bridge->type();
+  if (!obj["type"].isNull()) {
+    String s = obj["type"].as<String>();
+    in->type = SerialBridge::fromTypeString(s);
+    if (!SerialBridge::toString(in->type).equalsIgnoreCase(s)) { *error = bridge->code() + ": unknown type " + s; return false; }
+    if (!SerialBridge::isSupported(in->type)) { *error = bridge->code() + ": type " + s + " is not available on this device"; return false; }
+    if (in->type == SerialBridge::BridgeType::SERIAL_PEER && !bridge->peer()) { *error = bridge->code() + ": has no peer to cross-connect"; return false; }
+  }
+
+  in->fmt = bridge->format();
+  if (!obj["format"].isNull()) {
+    String s = obj["format"].as<String>();
+    in->fmt = SerialBridge::fromFormatString(s);
+    if (!SerialBridge::toString(in->fmt).equalsIgnoreCase(s)) { *error = bridge->code() + ": unknown format " + s; return false; }
+  }
+
+  // numbers are read wide and range checked before they are narrowed
+  long port = obj["port"] | (long)bridge->port();
+  long baud = obj["baud"] | (long)bridge->baud();
+  in->host = obj["host"] | bridge->host().c_str();
+  in->hasEcho = obj["hasEcho"] | bridge->hasEcho();
+  in->simulateEcho = obj["simulateEcho"] | bridge->simulateEcho();
+  in->rfc2217 = obj["rfc2217"] | bridge->rfc2217();
+  if (in->host.length() > SerialBridge::kMaxHostLength) { *error = bridge->code() + ": host too long"; return false; }
+  if (port < 1 || port > 65535) { *error = bridge->code() + ": invalid port"; return false; }
+  if (baud < (long)SerialBridge::kMinBaud || baud > (long)SerialBridge::kMaxBaud) { *error = bridge->code() + ": invalid baud"; return false; }
+  in->port = (ushort)port;
+  in->baud = (unsigned long)baud;
+
+  long dePin = obj["dePin"] | (long)bridge->rs485DePin();
+  in->hasRs485 = bridge->isUart() && (!obj["rs485"].isNull() || !obj["dePin"].isNull());
+  in->rs485 = obj["rs485"] | bridge->rs485();
+  if (!SerialBridge::isValidDePin(dePin)) { *error = bridge->code() + ": invalid dePin"; return false; }
+  in->dePin = (int8_t)dePin;
+
+  in->hasTransforms = !obj["transformsRx"].isNull() || !obj["transformsTx"].isNull();
+  long transformsRx = obj["transformsRx"] | (long)bridge->transforms(SerialBridge::Direction::SERIAL_TO_LINK);
+  long transformsTx = obj["transformsTx"] | (long)bridge->transforms(SerialBridge::Direction::LINK_TO_SERIAL);
+  if (transformsRx < 0 || transformsRx > ByteTransform::ALL) { *error = bridge->code() + ": invalid transformsRx"; return false; }
+  if (transformsTx < 0 || transformsTx > ByteTransform::ALL) { *error = bridge->code() + ": invalid transformsTx"; return false; }
+  in->transformsRx = (uint8_t)transformsRx;
+  in->transformsTx = (uint8_t)transformsTx;
+
+  in->qos = bridge->qos();
+  if (!obj["qos"].isNull()) {
+    String s = obj["qos"].as<String>();
+    in->qos = SerialBridge::fromQosString(s);
+    if (!SerialBridge::toString(in->qos).equalsIgnoreCase(s)) { *error = bridge->code() + ": unknown qos " + s; return false; }
+  }
+  in->hasQos = !obj["qos"].isNull() || !obj["rateLimit"].isNull();
+  long rateLimit = obj["rateLimit"] | (long)bridge->rateLimit();
+  bool rateOk = rateLimit == 0 || (rateLimit >= (long)SerialBridge::kMinRateLimit && rateLimit <= (long)SerialBridge::kMaxRateLimit);
+  if (!rateOk) { *error = bridge->code() + ": invalid rateLimit"; return false; }
+  in->rateLimit = (uint32_t)rateLimit;
+  return true;
+}
+
+static void bridgeApply(const BridgeInput& in)
+{
+  // same path as the ui save button, bridge type changes restart only this bridge in the background
+  in.bridge->setConfig(in.type, in.host, in.port, in.baud, in.fmt, in.hasEcho, in.simulateEcho, in.rfc2217);
+  if (in.hasRs485) in.bridge->setRs485Config(in.rs485, in.dePin);
+  if (in.hasTransforms) in.bridge->setTransforms(in.transformsRx, in.transformsTx);
+  if (in.hasQos) in.bridge->setQos(in.qos, in.rateLimit);
+}
+
+static void wifiToJson(JsonObject obj, bool secrets)
+{
+  String ssid, pass, hostname;
+  wifiGetConfig(&ssid, &pass, &hostname);
+  bool staticIp;
+  IPAddress ip, gw, mask, dns;
+  wifiGetStaticIp(&staticIp, &ip, &gw, &mask, &dns);
+
+  obj["ssid"] = ssid;
+  if (secrets) obj["password"] = pass;
+  obj["hostname"] = hostname;
+  obj["staticIp"] = staticIp;
+  obj["ip"] = ip.toString();
+  obj["gateway"] = gw.toString();
+  obj["mask"] = mask.toString();
+  obj["dns"] = dns.toString();
+
+  bool fastIp, roam;
+  wifiGetOptions(&fastIp, &roam);
+  obj["fastIp"] = fastIp;
+  obj["roam"] = roam;
+  // status, ignored on import
+  obj["lastReconnectMs"] = wifiLastReconnectMs();
+}
+
+static bool parseIp(JsonVariantConst v, IPAddress* ip, const char* name, String* error)
+{
+  if (v.isNull()) return true;
+  if (!ip->fromString(v.as<String>())) { *error = String("wifi: invalid ") + name; return false; }
+  return true;
+}
+
+static bool wifiFromJson(JsonObjectConst obj, WifiInput* in, String* error)
+{
+  if (!checkTypes<const char*>(obj, kWifiStrings, "a string", "wifi", error) ||
+      !checkTypes<bool>(obj, kWifiBools, "a boolean", "wifi", error)) return false;
+
+  wifiGetConfig(&in->ssid, &in->pass, &in->hostname);
+  wifiGetStaticIp(&in->staticIp, &in->ip, &in->gw, &in->mask, &in->dns);
+
+  in->ssid = obj["ssid"] | in->ssid.c_str();
+  in->pass = obj["password"] | in->pass.c_str();
+  in->hostname = obj["hostname"] | in->hostname.c_str();
+  in->staticIp = obj["staticIp"] | in->staticIp;
+  wifiGetOptions(&in->fastIp, &in->roam);
+  in->fastIp = obj["fastIp"] | in->fastIp;
+  in->roam = obj["roam"] | in->roam;
+  if (in->ssid.length() > 32) { *error = "wifi: ssid too long"; return false; }
+  if (in->pass.length() > 64) { *error = "wifi: password too long"; return false; }
+  return parseIp(obj["ip"], &in->ip, "ip", error) && parseIp(obj["gateway"], &in->gw, "gateway", error) &&
+    parseIp(obj["mask"], &in->mask, "mask", error) && parseIp(obj["dns"], &in->dns, "dns", error);
+}
+
+static void wifiApply(const WifiInput& in)
+{
+  // reconnect options are read when needed, no reconnect for them
+  bool fastIp, roam;
+  wifiGetOptions(&fastIp, &roam);
+  if (in.fastIp != fastIp || in.roam != roam) wifiSetOptions(in.fastIp, in.roam);
+
+  String ssid, pass, hostname;
+  wifiGetConfig(&ssid, &pass, &hostname);
+  bool staticIp;
+  IPAddress ip, gw, mask, dns;
+  wifiGetStaticIp(&staticIp, &ip, &gw, &mask, &dns);
+  if (in.ssid == ssid && in.pass == pass && in.hostname == hostname && in.staticIp == staticIp &&
+      in.ip == ip && in.gw == gw && in.mask == mask && in.dns == dns) return;
+
+  wifiSetConfig(&in.ssid, &in.pass, &in.hostname);
+  wifiSetStaticIp(in.staticIp, in.ip, in.gw, in.mask, in.dns);
+  // give the response time to leave before the link drops
+  wifiReconnectLater(500);
+}
+
+static void sendJson(AsyncWebServerRequest* req, const JsonDocument& doc, int code = 200)
+{
+  AsyncResponseStream* resp = req->beginResponseStream("application/json");
+  resp->setCode(code);
+  serializeJson(doc, *resp);
+  req->send(resp);
+}
+
+static void sendError(AsyncWebServerRequest* req, int code, const String& message)
+{
+  JsonDocument doc;
+  doc["error"] = message;
+  sendJson(req, doc, code);
+}
+
+// request bodies arrive in chunks, the request frees _tempObject when it is done
+static void collectBody(AsyncWebServerRequest* req, uint8_t* data, size_t len, size_t index, size_t total)
+{
+  if (total > kMaxBody) return;
+  if (index == 0) {
+    req->_tempObject = malloc(total + 1);
+    if (!req->_tempObject) return;
+    ((char*)req->_tempObject)[total] = 0;
+  }
+  if (req->_tempObject) memcpy((uint8_t*)req->_tempObject + index, data, len);
+}
+
+static bool parseBody(AsyncWebServerRequest* req, JsonDocument* doc)
+{
+  if (!req->_tempObject) {
+    sendError(req, req->contentLength() > kMaxBody ? 413 : 400, "missing or oversized body");
+    return false;
+  }
+  DeserializationError err = deserializeJson(*doc, (const char*)req->_tempObject);
+  if (err || !doc->is<JsonObject>()) {
+    sendError(req, 400, err ? String(err.c_str()) : String("expected an object"));
+    return false;
+  }
+  return true;
+}
+
+void configApiRegister(AsyncWebServer* server, const std::vector<SerialBridge*>& bridges)
+{
+  // more specific paths first, a handler also matches everything below its path
+  for (SerialBridge* bridge : bridges) {
+    String path = "/api/bridges/" + bridge->code();
+
+    server->on(path.c_str(), HTTP_GET, [bridge](AsyncWebServerRequest* req) {
+        JsonDocument doc;
+        bridgeToJson(bridge, doc.to<JsonObject>());
+        sendJson(req, doc);
+      }
+    );
+
+    server->on(path.c_str(), HTTP_PUT, [bridge](AsyncWebServerRequest* req) {
+        TRACE_SCOPE("api.putBridge");
+        JsonDocument doc;
+        if (!parseBody(req, &doc)) return;
+        BridgeInput in;
+        String error;
+        if (!bridgeFromJson(bridge, doc.as<JsonObjectConst>(), &in, &error)) { sendError(req, 400, error); return; }
+        bridgeApply(in);
+
+        JsonDocument out;
+        bridgeToJson(bridge, out.to<JsonObject>());
+        sendJson(req, out);
+      }, nullptr, collectBody
+    );
+  }
+
+  server->on("/api/bridges", HTTP_GET, [bridges](AsyncWebServerRequest* req) {
+      // the list handler also matches codes that no bridge handler took
+      if (req->url() != "/api/bridges" && req->url() != "/api/bridges/") { sendError(req, 404, "unknown bridge " + req->url().substring(13)); return; }
+      JsonDocument doc;
+      JsonArray arr = doc.to<JsonArray>();
+      for (SerialBridge* bridge : bridges) bridgeToJson(bridge, arr.add<JsonObject>());
+      sendJson(req, doc);
+    }
+  );
+
+  server->on("/api/wifi", HTTP_GET, [](AsyncWebServerRequest* req) {
+      JsonDocument doc;
+      wifiToJson(doc.to<JsonObject>(), false);
+      sendJson(req, doc);
+    }
+  );
+
+  server->on("/api/wifi", HTTP_PUT, [](AsyncWebServerRequest* req) {
+      TRACE_SCOPE("api.putWifi");
+      JsonDocument doc;
+      if (!parseBody(req, &doc)) return;
+      WifiInput in;
+      String error;
+      if (!wifiFromJson(doc.as<JsonObjectConst>(), &in, &error)) { sendError(req, 400, error); return; }
+      wifiApply(in);
+
+      JsonDocument out;
+      wifiToJson(out.to<JsonObject>(), false);
+      sendJson(req, out);
+    }, nullptr, collectBody
+  );
+
+  server->on("/api/config", HTTP_GET, [bridges](AsyncWebServerRequest* req) {
+      bool secrets = req->hasParam("secrets") && req->getParam("secrets")->value() == "1";
+      JsonDocument doc;
+      wifiToJson(doc["wifi"].to<JsonObject>(), secrets);
+      JsonArray arr = doc["bridges"].to<JsonArray>();
+      for (SerialBridge* bridge : bridges) bridgeToJson(bridge, arr.add<JsonObject>());
+      sendJson(req, doc);
+    }
+  );
+
+  // bulk import, all or nothing: every section is validated before the first one is applied
+  server->on("/api/config", HTTP_POST, [bridges](AsyncWebServerRequest* req) {
+      TRACE_SCOPE("api.postConfig");
+      JsonDocument doc;
+      if (!parseBody(req, &doc)) return;
+      String error;
+
+      std::vector<BridgeInput> inputs;
+      for (JsonObjectConst obj : doc["bridges"].as<JsonArrayConst>()) {
+        String code = obj["code"] | "";
+        auto it = std::find_if(bridges.begin(), bridges.end(), [&](SerialBridge* b) { return b->code() == code; });
+        if (it == bridges.end()) { sendError(req, 400, "unknown bridge " + code); return; }
+        BridgeInput in;
+        if (!bridgeFromJson(*it, obj, &in, &error)) { sendError(req, 400, error); return; }
+        inputs.push_back(in);
+      }
+
+      WifiInput wifi;
+      bool hasWifi = doc["wifi"].is<JsonObjectConst>();
+      if (hasWifi && !wifiFromJson(doc["wifi"].as<JsonObjectConst>(), &wifi, &error)) { sendError(req, 400, error); return; }
+
+      Log.infoln("Config import: %u bridges%s", inputs.size(), hasWifi ? " and wifi" : "");
+      for (const BridgeInput& in : inputs) bridgeApply(in);
+      if (hasWifi) wifiApply(wifi);
+      req->send(204);
+    }, nullptr, collectBody
+  );
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+
+class AsyncWebServer;
+class SerialBridge;
+
+// JSON configuration API, changes are saved and applied live:
+//   GET/PUT  /api/bridges/<code>   one bridge, PUT takes any subset of the fields
+//   GET      /api/bridges          all bridges
+//   GET/PUT  /api/wifi             wifi settings, the password is write only
+//   GET/POST /api/config           whole device, {"wifi":{...},"bridges":[...]}
+// GET /api/config?secrets=1 includes the wifi password so the export can be imported elsewhere.
+void configApiRegister(AsyncWebServer* server, const std::vector<SerialBridge*>& bridges);
@@ -0,0 +1,435 @@
+#include <ESPAsyncWebServer.h>
+
+#include "FlashLog.h"
+
+#if FLASH_LOG
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <algorithm>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <memory>
+#include <mutex>
+
+static constexpr uint8_t kSegments = 8;
+static constexpr size_t kSegmentSize = 16 * 1024;
+static constexpr size_t kRtcSize = 2048;          // power of two
+static_assert((kRtcSize & (kRtcSize - 1)) == 0, "rtc ring size must be a power of two");
+static constexpr uint32_t kRtcMagic = 0x464C4F47;  // "FLOG"
+static constexpr uint8_t kRecordMagic = 0xA5;
+static constexpr size_t kRecordHeader = 5;
+static constexpr size_t kMaxLine = 256;           // longer lines are split
+static constexpr uint32_t kFlushIntervalMs = 5000;   // rtc memory covers the gap, keep flash commits rare
+
+// pending log text, survives every reset but a power cycle
+struct RtcLog {
+  uint32_t magic;
+  uint32_t head;      // bytes ever written
+  uint32_t flushed;   // bytes moved to flash
+  uint32_t dropped;   // bytes lost to a full ring
+  char data[kRtcSize];
+};
+RTC_NOINIT_ATTR static RtcLog g_rtc;
+
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t g_flusher = nullptr;
+
+// flash side, only touched by the flusher (and flashLogBegin before it runs)
+static uint16_t g_boot = 0;
+static uint8_t g_segment = 0;
+static uint32_t g_segmentSeq = 0;
+static size_t g_segmentBytes = 0;
+static uint32_t g_slotSeq[kSegments];   // sequence held by each segment file, 0 for none
+
+// held by the flusher while it moves lines to flash and by history readers while they read,
+// so a reader sees each line either in a segment or in rtc memory, and notices rotation
+static std::mutex g_flashMutex;
+
+class FlashLogPrint : public Print {
+  public:
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* b, size_t n) override;
+};
+static FlashLogPrint g_print;
+
+size_t FlashLogPrint::write(const uint8_t* b, size_t n)
+{
+  portENTER_CRITICAL(&g_lock);
+  for (size_t i = 0; i < n; ++i) {
+    // the flusher is behind, keep what is not on flash yet and drop the new bytes
+    if (g_rtc.head - g_rtc.flushed >= kRtcSize) { g_rtc.dropped += n - i; break; }
+    g_rtc.data[g_rtc.head & (kRtcSize - 1)] = (char)b[i];
+    g_rtc.head++;
+  }
+  bool wake = g_rtc.head - g_rtc.flushed >= kRtcSize / 2;
+  portEXIT_CRITICAL(&g_lock);
+
+  if (wake && g_flusher) xTaskNotifyGive(g_flusher);
+  return n;
+}
+
+static String segmentPath(uint8_t i)
+{
+  return "/log/" + String(i);
+}
+
+// 0 for a missing or empty segment, sequences start at 1
+static uint32_t segmentSeq(uint8_t i, size_t* size = nullptr)
+{
+  File f = LittleFS.open(segmentPath(i), "r");
+  uint32_t seq = 0;
+  if (!f) return 0;
+  if (f.read((uint8_t*)&seq, sizeof(seq)) != sizeof(seq)) seq = 0;
+  if (size) *size = f.size();
+  return seq;
+}
+
+// overwrites the oldest segment
+static File nextSegment()
+{
+  g_segment = (g_segment + 1) % kSegments;
+  g_segmentSeq++;
+  File f = LittleFS.open(segmentPath(g_segment), "w");
+  if (f) f.write((const uint8_t*)&g_segmentSeq, sizeof(g_segmentSeq));
+  g_slotSeq[g_segment] = g_segmentSeq;
+  g_segmentBytes = sizeof(g_segmentSeq);
+  return f;
+}
+
+static File openSegment()
+{
+  if (g_segmentBytes >= kSegmentSize) return nextSegment();
+  return LittleFS.open(segmentPath(g_segment), "a");
+}
+
+static void writeRecord(File& f, const char* text, size_t len)
+{
+  uint8_t header[kRecordHeader] = { kRecordMagic, (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)g_boot, (uint8_t)(g_boot >> 8) };
+  f.write(header, sizeof(header));
+  f.write((const uint8_t*)text, len);
+  g_segmentBytes += sizeof(header) + len;
+
+  if (g_segmentBytes >= kSegmentSize) {
+    f.close();
+    f = nextSegment();
+  }
+}
+
+static void writeLine(const char* text)
+{
+  File f = openSegment();
+  if (!f) return;
+  writeRecord(f, text, strlen(text));
+  f.close();
+}
+
+// moves complete lines from rtc memory to flash, everything when all is set
+static void flashLogFlush(bool all)
+{
+  std::lock_guard<std::mutex> lock(g_flashMutex);
+
+  uint32_t flushed, head, dropped;
+  portENTER_CRITICAL(&g_lock);
+  flushed = g_rtc.flushed;
+  head = g_rtc.head;
+  dropped = g_rtc.dropped;
+  g_rtc.dropped = 0;
+  portEXIT_CRITICAL(&g_lock);
+
+  if (dropped) {
+    char note[48];
+    snprintf(note, sizeof(note), "[flashlog dropped %u bytes]", dropped);
+    writeLine(note);
+  }
+  if (head == flushed) return;
+
+  File f = openSegment();
+  if (!f) return;
+
+  // writers only append past head, the bytes up to it stay put until flushed moves
+  char line[kMaxLine];
+  size_t len = 0;
+  uint32_t done = flushed;
+  for (uint32_t pos = flushed; pos != head; ++pos) {
+    char c = g_rtc.data[pos & (kRtcSize - 1)];
+    if (c == '\n') {
+      writeRecord(f, line, len);
+      len = 0;
+      done = pos + 1;
+      continue;
+    }
+    if (len == sizeof(line)) {
+      writeRecord(f, line, len);
+      len = 0;
+      done = pos;
+    }
+    if (c != '\r') line[len++] = c;
+  }
+  if (all && len) {
+    writeRecord(f, line, len);
+    done = head;
+  }
+  f.close();
+
+  portENTER_CRITICAL(&g_lock);
+  g_rtc.flushed = done;
+  portEXIT_CRITICAL(&g_lock);
+}
+
+static void flashLogTask(void*)
+{
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kFlushIntervalMs));
+    flashLogFlush(false);
+  }
+}
+
+static const char* resetReasonName(esp_reset_reason_t reason)
+{
+  switch (reason) {
+    case ESP_RST_POWERON: return "power on";
+    case ESP_RST_EXT: return "external pin";
+    case ESP_RST_SW: return "software";
+    case ESP_RST_PANIC: return "panic";
+    case ESP_RST_INT_WDT: return "interrupt watchdog";
+    case ESP_RST_TASK_WDT: return "task watchdog";
+    case ESP_RST_WDT: return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deep sleep";
+    case ESP_RST_BROWNOUT: return "brownout";
+    case ESP_RST_SDIO: return "sdio";
+    default: return "unknown";
+  }
+}
+
+Print* flashLogBegin()
+{
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool rtcValid = reason != ESP_RST_POWERON && g_rtc.magic == kRtcMagic && g_rtc.head - g_rtc.flushed <= kRtcSize;
+  if (!rtcValid) {
+    g_rtc.magic = kRtcMagic;
+    g_rtc.head = 0;
+    g_rtc.flushed = 0;
+    g_rtc.dropped = 0;
+  }
+
+  if (!LittleFS.begin(true)) return nullptr;
+  LittleFS.mkdir("/log");
+
+  // append to the newest segment
+  g_segmentSeq = 0;
+  g_segment = kSegments - 1;
+  g_segmentBytes = kSegmentSize;
+  for (uint8_t i = 0; i < kSegments; ++i) {
+    size_t size = 0;
+    uint32_t seq = segmentSeq(i, &size);
+    g_slotSeq[i] = seq;
+    if (seq > g_segmentSeq) {
+      g_segmentSeq = seq;
+      g_segment = i;
+      g_segmentBytes = size;
+    }
+  }
+
+  Preferences prefs;
+  if (prefs.begin("flashlog", false)) {
+    g_boot = prefs.getUShort("boot", 0);
+
+    // the previous boot's last lines never made it to flash, they go in under its boot number
+    if (rtcValid && g_rtc.head != g_rtc.flushed) {
+      char note[64];
+      snprintf(note, sizeof(note), "--- %u bytes recovered from rtc memory ---", g_rtc.head - g_rtc.flushed);
+      writeLine(note);
+      flashLogFlush(true);
+    }
+
+    g_boot++;
+    prefs.putUShort("boot", g_boot);
+    prefs.end();
+  }
+
+  char note[64];
+  snprintf(note, sizeof(note), "=== boot %u, reset reason: %s ===", g_boot, resetReasonName(reason));
+  writeLine(note);
+
+  xTaskCreate(flashLogTask, "FlashLog", 3072, nullptr, 1, &g_flusher);
+  return &g_print;
+}
+
+// streams the segments oldest first, then whatever is still waiting in rtc memory
+struct HistoryReader {
+  uint8_t order[kSegments];
+  uint32_t seq[kSegments];    // per order entry, a segment rotated since is skipped
+  size_t size[kSegments];     // per order entry, later records are still in pending
+  uint8_t count = 0;
+  uint8_t next = 0;
+  File file;
+  size_t fileLeft = 0;
+  String pending;
+  int pendingPos = 0;
+  String out;
+  size_t outPos = 0;
+  bool started = false;
+  bool first = true;
+  bool done = false;
+};
+
+static std::shared_ptr<HistoryReader> historySnapshot()
+{
+  auto reader = std::make_shared<HistoryReader>();
+  std::unique_ptr<char[]> tmp(new char[kRtcSize + 1]);
+  size_t len = 0;
+
+  // segment sizes and the rtc tail from the same moment, no flush in between
+  std::lock_guard<std::mutex> lock(g_flashMutex);
+
+  std::pair<uint32_t, uint8_t> segments[kSegments];
+  size_t sizes[kSegments];
+  for (uint8_t i = 0; i < kSegments; ++i) {
+    uint32_t seq = segmentSeq(i, &sizes[i]);
+    if (seq) segments[reader->count++] = { seq, i };
+  }
+  std::sort(segments, segments + reader->count);
+  for (uint8_t i = 0; i < reader->count; ++i) {
+    reader->order[i] = segments[i].second;
+    reader->seq[i] = segments[i].first;
+    reader->size[i] = sizes[segments[i].second];
+  }
+
+  portENTER_CRITICAL(&g_lock);
+  for (uint32_t pos = g_rtc.flushed; pos != g_rtc.head; ++pos) tmp[len++] = g_rtc.data[pos & (kRtcSize - 1)];
+  portEXIT_CRITICAL(&g_lock);
+  tmp[len] = 0;
+  reader->pending = tmp.get();
+  reader->pending.replace("\r", "");
+  return reader;
+}
+
+// called with g_flashMutex held
+static bool historyNextLine(HistoryReader& r, String* line)
+{
+  for (;;) {
+    // the flusher reused the slot for newer lines since the snapshot, the old ones are gone
+    if (r.file && g_slotSeq[r.order[r.next - 1]] != r.seq[r.next - 1]) r.file.close();
+
+    if (r.file) {
+      uint8_t header[kRecordHeader];
+      char text[kMaxLine + 1];
+      if (r.fileLeft >= sizeof(header) && r.file.read(header, sizeof(header)) == sizeof(header) && header[0] == kRecordMagic) {
+        size_t len = header[1] | (header[2] << 8);
+        r.fileLeft -= sizeof(header);
+        // a torn record at the end of a segment ends it, records past the snapshot are read from pending
+        if (len <= kMaxLine && len <= r.fileLeft && r.file.read((uint8_t*)text, len) == len) {
+          r.fileLeft -= len;
+          text[len] = 0;
+          *line = text;
+          return true;
+        }
+      }
+      r.file.close();
+    }
+
+    if (r.next < r.count) {
+      uint8_t i = r.next++;
+      if (g_slotSeq[r.order[i]] != r.seq[i] || r.size[i] < sizeof(uint32_t)) continue;
+      r.file = LittleFS.open(segmentPath(r.order[i]), "r");
+      if (r.file) r.file.seek(sizeof(uint32_t));
+      r.fileLeft = r.size[i] - sizeof(uint32_t);
+      continue;
+    }
+
+    if (r.pendingPos < (int)r.pending.length()) {
+      int nl = r.pending.indexOf('\n', r.pendingPos);
+      if (nl < 0) nl = r.pending.length();
+      *line = r.pending.substring(r.pendingPos, nl);
+      r.pendingPos = nl + 1;
+      return true;
+    }
+    return false;
+  }
+}
+
+// the log page appends entries as they are, lines keep their newline
+static void appendJsonString(String& out, const String& s)
+{
+  out += '"';
+  for (size_t i = 0; i < s.length(); ++i) {
+    char c = s[i];
+    if (c == '"' || c == '\\') { out += '\\'; out += c; }
+    else if ((uint8_t)c < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", (uint8_t)c);
+      out += esc;
+    }
+    else out += c;
+  }
+  out += "\\n\"";
+}
+
+static size_t historyFill(HistoryReader& r, uint8_t* buffer, size_t maxLen)
+{
+  size_t len = 0;
+  while (len < maxLen) {
+    if (r.outPos < r.out.length()) {
+      size_t n = std::min(maxLen - len, r.out.length() - r.outPos);
+      memcpy(buffer + len, r.out.c_str() + r.outPos, n);
+      len += n;
+      r.outPos += n;
+      continue;
+    }
+    if (r.done) break;
+
+    r.out = "";
+    r.outPos = 0;
+    if (!r.started) {
+      r.out = "[";
+      r.started = true;
+      continue;
+    }
+
+    String line;
+    bool more;
+    {
+      std::lock_guard<std::mutex> lock(g_flashMutex);
+      more = historyNextLine(r, &line);
+    }
+    if (more) {
+      if (!r.first) r.out += ',';
+      r.first = false;
+      appendJsonString(r.out, line);
+    } else {
+      r.out = "]";
+      r.done = true;
+    }
+  }
+  return len;
+}
+
+void flashLogRegister(AsyncWebServer* server)
+{
+  server->on("/logs/history", HTTP_GET, [](AsyncWebServerRequest* req) {
+      auto reader = historySnapshot();
+      req->send(req->beginChunkedResponse("application/json", [reader](uint8_t* buffer, size_t maxLen, size_t) -> size_t {
+          return historyFill(*reader, buffer, maxLen);
+        }
+      ));
+    }
+  );
+}
+
+#else
+
+Print* flashLogBegin() { return nullptr; }
+
+void flashLogRegister(AsyncWebServer* server)
+{
+  server->on("/logs/history", HTTP_GET, [](AsyncWebServerRequest* req) {
+      req->send(200, "application/json", "[]");
+    }
+  );
+}
+
+#endif
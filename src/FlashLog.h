@@ -0,0 +1,24 @@
+#pragma once
+
+// Persistent log sink, enable with -DFLASH_LOG=1. Log output goes into a
+// small ring in RTC memory that survives resets, a low priority task moves
+// complete lines from there into a ring of LittleFS segment files, so no
+// flash I/O ever happens on the task that logs. After a crash the lines that
+// had not reached flash yet are recovered from RTC memory on the next boot.
+//
+// Flash records are [0xA5][len u16 le][boot u16 le][text], one per line.
+// /logs/history serves the persisted lines oldest first as a JSON array.
+
+#include <Print.h>
+
+#ifndef FLASH_LOG
+  #define FLASH_LOG 0
+#endif
+
+class AsyncWebServer;
+
+// mounts the filesystem and recovers the previous boot's tail, call before the
+// first log line; returns the sink to add to the log output, nullptr when disabled
+Print* flashLogBegin();
+// /logs/history, an empty list when disabled
+void flashLogRegister(AsyncWebServer* server);
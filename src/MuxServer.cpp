@@ -0,0 +1,323 @@
+#include <ArduinoLog.h>
+#include <mutex>
+
+#include "MuxServer.h"
+#include "SerialBridge.h"
+
+std::mutex g_muxMutex;
+
+MuxServer& MuxServer::instance()
+{
+  static MuxServer server;
+  return server;
+}
+
+bool MuxServer::attach(SerialBridge* bridge)
+{
+  std::lock_guard<std::mutex> lock(g_muxMutex);
+
+  // reuse a detached slot so the other channel numbers stay put
+  uint8_t slot = 0;
+  while (slot < m_count && m_channels[slot].bridge) slot++;
+  if (slot >= kMaxChannels) {
+    Log.errorln("Mux(%s) no free channel, cannot attach", bridge->code().c_str());
+    return false;
+  }
+
+  // the task only reads slots below m_count and skips empty ones, publish the bridge last
+  Channel& ch = m_channels[slot];
+  if (!ch.rxBuf) ch.rxBuf = new uint8_t[kWindow];
+  ch.initialized = false;
+  ch.announced = false;
+  ch.txCredit = kWindow;
+  ch.rxOwed = 0;
+  ch.rxHead = 0;
+  ch.rxLen = 0;
+  ch.bridge = bridge;
+  if (slot == m_count) m_count = m_count + 1;
+  Log.infoln("Mux(%s) attached as channel %u", bridge->code().c_str(), slot);
+
+  if (!m_started) {
+    m_detached = xSemaphoreCreateBinary();
+    m_started = true;
+    xTaskCreate((TaskFunction_t)(&MuxServer::task), "MuxServer", 3072, this, 1, nullptr);
+  }
+  return true;
+}
+
+void MuxServer::detach(SerialBridge* bridge)
+{
+  std::lock_guard<std::mutex> lock(g_muxMutex);
+
+  if (!m_started) return;
+
+  // the task drops the slot between two passes over the channels, the bridge
+  // must not be touched again once we return, so there is no giving up here
+  m_detach = bridge;
+  while (xSemaphoreTake(m_detached, pdMS_TO_TICKS(2000)) != pdTRUE) {
+    Log.warningln("Mux(%s) still waiting for the mux task to release the channel", bridge->code().c_str());
+  }
+  Log.infoln("Mux(%s) detached", bridge->code().c_str());
+}
+
+void MuxServer::task()
+{
+  Log.infoln("MuxServer started task on port %u...", kPort);
+
+  WiFiServer server(kPort, 1);
+  uint8_t buffer[4 + kMaxPayload];
+
+  for (;;)
+  {
+    // wait for WiFi
+    m_linkState = SerialBridge::LinkState::WAITING;
+    while (WiFi.status() != WL_CONNECTED) { prepareChannels(nullptr); delay(250); }
+    server.begin();
+    server.setNoDelay(true);
+    m_linkState = SerialBridge::LinkState::LISTENING;
+
+    while (WiFi.status() == WL_CONNECTED) {
+      prepareChannels(nullptr);
+      WiFiClient client = server.accept();
+      if (!client) { delay(20); continue; }
+      client.setNoDelay(true);
+
+      Log.infoln("MuxServer accepted client from %s:%u", client.remoteIP().toString().c_str(), client.remotePort());
+      m_remoteIp = (uint32_t)client.remoteIP();
+      m_remotePort = client.remotePort();
+      m_linkState = SerialBridge::LinkState::CONNECTED;
+      resetSession();
+
+      // serve all channels to this single client until it disconnects
+      while (client.connected() && WiFi.status() == WL_CONNECTED) {
+        prepareChannels(&client);
+        bool busy = receiveFrames(client, buffer, sizeof(buffer));
+        busy |= serviceChannels(client, buffer);
+
+        // small delay to yield cpu
+        if (!busy) delay(2);
+      }
+
+      Log.infoln("MuxServer client disconnected");
+
+      client.stop();
+      m_linkState = SerialBridge::LinkState::LISTENING;
+      delay(10);
+    }
+  }
+}
+
+void MuxServer::prepareChannels(WiFiClient* client)
+{
+  uint8_t count = m_count;
+
+  SerialBridge* detach = m_detach;
+  if (detach) {
+    for (uint8_t i = 0; i < count; ++i) {
+      Channel& ch = m_channels[i];
+      if (ch.bridge != detach) continue;
+      // tell the host so it stops sending and drops its local port for the channel
+      if (client && ch.announced) sendFrame(*client, i, FLAG_CLOSE, nullptr, 0);
+      ch.announced = false;
+      ch.bridge = nullptr;
+      detach->setLink(SerialBridge::LinkState::STOPPED);
+    }
+    m_detach = nullptr;
+    xSemaphoreGive(m_detached);
+  }
+
+  // the shared task runs at the priority of its most demanding channel
+  UBaseType_t priority = SerialBridge::taskPriority(SerialBridge::QosClass::BULK);
+  for (uint8_t i = 0; i < count; ++i) {
+    Channel& ch = m_channels[i];
+    if (!ch.bridge) continue;
+    UBaseType_t channelPriority = SerialBridge::taskPriority(ch.bridge->qos());
+    if (channelPriority > priority) priority = channelPriority;
+    if (!ch.initialized) {
+      ch.bridge->initStream();
+      ch.initialized = true;
+    }
+    ch.bridge->serviceConfig();
+    ch.bridge->setLink(m_linkState, m_remoteIp, m_remotePort);
+  }
+  if (uxTaskPriorityGet(nullptr) != priority) vTaskPrioritySet(nullptr, priority);
+}
+
+void MuxServer::resetSession()
+{
+  m_headerLen = 0;
+  m_payloadLeft = 0;
+  m_creditLen = 0;
+
+  uint8_t count = m_count;
+  for (uint8_t i = 0; i < count; ++i) {
+    m_channels[i].announced = false;
+    m_channels[i].txCredit = kWindow;
+    m_channels[i].rxOwed = 0;
+    m_channels[i].rxHead = 0;
+    m_channels[i].rxLen = 0;
+    if (m_channels[i].bridge) m_channels[i].bridge->m_stats.connections++;
+  }
+}
+
+bool MuxServer::serviceChannels(WiFiClient& client, uint8_t* buf)
+{
+  bool busy = false;
+  uint8_t count = m_count;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    Channel& ch = m_channels[i];
+    SerialBridge* bridge = ch.bridge;
+    if (!bridge) continue;
+
+    // TCP -> Serial, as much as the port takes without blocking, then release the bus
+    busy |= drainRx(ch, buf);
+    bridge->endSerialWrite();
+
+    if (!ch.announced) {
+      sendFrame(client, i, FLAG_OPEN, (const uint8_t*)bridge->code().c_str(), bridge->code().length());
+      ch.announced = true;
+    }
+
+    // Serial -> TCP, bounded by the credit the host has granted after the transform, and by the qos gate
+    const ByteTransform& xf = bridge->m_transforms[static_cast<uint8_t>(SerialBridge::Direction::SERIAL_TO_LINK)];
+    size_t room = (ch.txCredit < kMaxPayload) ? ch.txCredit : kMaxPayload;
+    size_t offset = xf.inputOffset(room);
+    int avail = bridge->m_paused ? 0 : bridge->m_stream->available();
+    size_t n = (avail > 0) ? (size_t)avail : 0;
+    size_t budget = bridge->beginSend(n);
+    if (n > xf.inputCap(room)) n = xf.inputCap(room);
+    if (n > budget) n = budget;
+    if (n > 0) {
+      int r = bridge->m_stream->readBytes(buf + 4 + offset, n);
+      if (r > 0) {
+        bridge->account(SerialBridge::Direction::SERIAL_TO_LINK, buf + 4 + offset, (size_t)r);
+        size_t len = xf.apply(buf + 4, offset, (size_t)r);
+        // header and payload in one write, one segment per frame
+        buf[0] = i;
+        buf[1] = FLAG_DATA;
+        buf[2] = (uint8_t)len;
+        buf[3] = (uint8_t)(len >> 8);
+        if (len) client.write(buf, 4 + len);
+        ch.txCredit -= (uint32_t)len;
+        bridge->sent((size_t)r, len);
+        busy = true;
+      }
+    }
+
+    // hand back credit for what went out the serial port, in batches
+    if (ch.rxOwed >= kWindow / 4) {
+      sendCredit(client, i, (uint16_t)ch.rxOwed);
+      ch.rxOwed = 0;
+    }
+  }
+
+  return busy;
+}
+
+bool MuxServer::receiveFrames(WiFiClient& client, uint8_t* buf, size_t cap)
+{
+  bool busy = false;
+
+  while (client.available() > 0) {
+    busy = true;
+
+    // frame header, may arrive split over several reads
+    if (m_headerLen < sizeof(m_header)) {
+      int r = client.read(m_header + m_headerLen, sizeof(m_header) - m_headerLen);
+      if (r <= 0) break;
+      m_headerLen += (size_t)r;
+      if (m_headerLen == sizeof(m_header)) {
+        m_payloadLeft = m_header[2] | (m_header[3] << 8);
+        m_creditLen = 0;
+        if (m_payloadLeft == 0) m_headerLen = 0;
+      }
+      continue;
+    }
+
+    uint8_t chan = m_header[0];
+    uint8_t flags = m_header[1];
+
+    size_t n = (m_payloadLeft > cap) ? cap : m_payloadLeft;
+    int r = client.read(buf, n);
+    if (r <= 0) break;
+    m_payloadLeft -= (size_t)r;
+
+    // data for a detached channel is dropped
+    if (chan < m_count && m_channels[chan].bridge) {
+      Channel& ch = m_channels[chan];
+      if (flags == FLAG_DATA) {
+        // queued as sent, the credit it earns back is granted once it reached the port
+        queueRx(ch, buf, (size_t)r);
+      } else if (flags == FLAG_CREDIT) {
+        for (int i = 0; i < r && m_creditLen < sizeof(m_credit); ++i) m_credit[m_creditLen++] = buf[i];
+        if (m_payloadLeft == 0 && m_creditLen == sizeof(m_credit)) ch.txCredit += m_credit[0] | (m_credit[1] << 8);
+      }
+    }
+
+    // next frame
+    if (m_payloadLeft == 0) m_headerLen = 0;
+  }
+
+  return busy;
+}
+
+void MuxServer::queueRx(Channel& ch, const uint8_t* data, size_t len)
+{
+  // the host never has more than kWindow bytes in flight, anything beyond that is dropped
+  size_t room = kWindow - ch.rxLen;
+  if (len > room) {
+    Log.warningln("Mux(%s) host overran its credit, dropped %u bytes", ch.bridge->code().c_str(), (unsigned)(len - room));
+    len = room;
+  }
+
+  while (len > 0) {
+    size_t tail = (ch.rxHead + ch.rxLen) % kWindow;
+    size_t n = kWindow - tail;
+    if (n > len) n = len;
+    memcpy(ch.rxBuf + tail, data, n);
+    ch.rxLen += n;
+    data += n;
+    len -= n;
+  }
+}
+
+bool MuxServer::drainRx(Channel& ch, uint8_t* buf)
+{
+  SerialBridge* bridge = ch.bridge;
+  if (ch.rxLen == 0 || bridge->m_paused) return false;
+
+  // the transform may grow the data, only take what still fits the port's free space afterwards
+  const ByteTransform& xf = bridge->m_transforms[static_cast<uint8_t>(SerialBridge::Direction::LINK_TO_SERIAL)];
+  int space = bridge->m_stream->availableForWrite();
+  size_t room = (space > 0) ? (size_t)space : 0;
+  if (room > kMaxPayload) room = kMaxPayload;
+  size_t n = xf.inputCap(room);
+  if (n > ch.rxLen) n = ch.rxLen;
+  if (n > (size_t)(kWindow - ch.rxHead)) n = kWindow - ch.rxHead;
+  if (n == 0) return false;
+
+  size_t offset = xf.inputOffset(room);
+  memcpy(buf + offset, ch.rxBuf + ch.rxHead, n);
+  ch.rxHead = (ch.rxHead + n) % kWindow;
+  ch.rxLen -= n;
+
+  size_t len = xf.apply(buf, offset, n);
+  bridge->writeSerial(buf, len);
+  bridge->account(SerialBridge::Direction::LINK_TO_SERIAL, buf, len);
+  ch.rxOwed += (uint32_t)n;
+  return true;
+}
+
+void MuxServer::sendFrame(WiFiClient& client, uint8_t chan, uint8_t flags, const uint8_t* payload, uint16_t len)
+{
+  uint8_t header[4] = { chan, flags, (uint8_t)len, (uint8_t)(len >> 8) };
+  client.write(header, sizeof(header));
+  if (len) client.write(payload, len);
+}
+
+void MuxServer::sendCredit(WiFiClient& client, uint8_t chan, uint16_t credit)
+{
+  uint8_t payload[2] = { (uint8_t)credit, (uint8_t)(credit >> 8) };
+  sendFrame(client, chan, FLAG_CREDIT, payload, sizeof(payload));
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "SerialBridge.h"
+
+// Serves every multiplexed bridge over a single TCP connection.
+//
+// Frames are a 4 byte header followed by the payload:
+//   [channel][flags][length lo][length hi][payload...]
+//
+// flags 0x00 DATA   payload is serial data for/from the channel
+// flags 0x01 CREDIT payload is a little endian u16, the receiver may send
+//                   that many more DATA bytes on the channel
+// flags 0x02 OPEN   device to host, payload is the bridge code
+// flags 0x03 CLOSE  device to host, no payload, the bridge was detached and
+//                   the host drops the channel until it is opened again
+//
+// Each side starts with kWindow bytes of credit per channel and grants more
+// as it drains data to its serial port or local client. Host data is queued
+// per channel and written only as fast as each port takes it, so a slow
+// or paused port never holds up the other channels.
+class MuxServer {
+  public:
+    static constexpr uint8_t kMaxChannels = 8;
+    static constexpr uint16_t kMaxPayload = 512;
+    static constexpr uint16_t kWindow = 2048;
+    static constexpr uint16_t kPort = 3300;
+
+    static constexpr uint8_t FLAG_DATA = 0x00;
+    static constexpr uint8_t FLAG_CREDIT = 0x01;
+    static constexpr uint8_t FLAG_OPEN = 0x02;
+    static constexpr uint8_t FLAG_CLOSE = 0x03;
+
+    static MuxServer& instance();
+
+    // false when all channels are taken, the bridge is not served then
+    bool attach(SerialBridge* bridge);
+    // frees the bridge's channel, returns once the mux task let go of it
+    void detach(SerialBridge* bridge);
+    uint16_t port() { return kPort; }
+
+  private:
+    MuxServer() = default;
+
+    struct Channel {
+      SerialBridge* bridge;   // nullptr for a detached slot
+      bool initialized;
+      bool announced;
+      uint32_t txCredit;   // bytes we may still send to the host
+      uint32_t rxOwed;     // bytes drained to serial, not yet granted back
+      uint8_t* rxBuf;      // kWindow bytes from the host waiting for the port, as sent
+      uint16_t rxHead;
+      uint16_t rxLen;
+    };
+
+    Channel m_channels[kMaxChannels] = {};
+    volatile uint8_t m_count = 0;
+    bool m_started = false;
+    SerialBridge* volatile m_detach = nullptr;
+    SemaphoreHandle_t m_detached = nullptr;   // given by the task once it dropped m_detach
+
+    // session state, handed to every attached bridge for the ui
+    SerialBridge::LinkState m_linkState = SerialBridge::LinkState::WAITING;
+    uint32_t m_remoteIp = 0;
+    uint16_t m_remotePort = 0;
+
+    // frame parser state for host -> device data
+    uint8_t m_header[4];
+    size_t m_headerLen = 0;
+    size_t m_payloadLeft = 0;
+    uint8_t m_credit[2];
+    size_t m_creditLen = 0;
+
+    void task();
+    void prepareChannels(WiFiClient* client);
+    void resetSession();
+    bool serviceChannels(WiFiClient& client, uint8_t* buf);
+    bool receiveFrames(WiFiClient& client, uint8_t* buf, size_t cap);
+    void queueRx(Channel& ch, const uint8_t* data, size_t len);
+    bool drainRx(Channel& ch, uint8_t* buf);
+    void sendFrame(WiFiClient& client, uint8_t chan, uint8_t flags, const uint8_t* payload, uint16_t len);
+    void sendCredit(WiFiClient& client, uint8_t chan, uint16_t credit);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ESPAsyncWebServer.h>
+#include "Trace.h"
 
 class WebSocketPrint : public Print {
 public:
@@ -20,6 +21,7 @@ public:
     return n;
   }
   void flush() override {
+    TRACE_SCOPE("log.flush");
     if (_ws && _tx.length()) { _ws->textAll(_tx); _tx = ""; }
   }
 
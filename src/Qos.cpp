@@ -0,0 +1,75 @@
+#include "Qos.h"
+
+static constexpr int64_t kUsPerSecond = 1000000;
+
+void TokenBucket::configure(uint32_t rate, uint32_t nowUs)
+{
+  // a tenth of a second worth of data may go out at once
+  uint32_t burst = rate / 10;
+  if (burst < kMinBurst) burst = kMinBurst;
+
+  m_rate = rate;
+  m_burst = (int64_t)burst * kUsPerSecond;
+  m_tokens = m_burst;
+  m_lastUs = nowUs;
+}
+
+size_t TokenBucket::available(uint32_t nowUs)
+{
+  if (m_rate == 0) return SIZE_MAX;
+
+  // tokens are kept in byte microseconds so slow rates do not lose fractions
+  uint32_t elapsedUs = nowUs - m_lastUs;
+  m_lastUs = nowUs;
+  m_tokens += (int64_t)elapsedUs * m_rate;
+  if (m_tokens > m_burst) m_tokens = m_burst;
+
+  return m_tokens > 0 ? (size_t)(m_tokens / kUsPerSecond) : 0;
+}
+
+void TokenBucket::consume(size_t n)
+{
+  if (m_rate == 0) return;
+  m_tokens -= (int64_t)n * kUsPerSecond;
+}
+
+void QueueDelay::observe(size_t pending, uint32_t nowUs)
+{
+  if (pending == 0) { m_count = 0; return; }
+
+  uint32_t seen = m_sent + (uint32_t)pending;
+  if (m_count) {
+    Mark& last = m_marks[(m_head + m_count - 1) % kMarks];
+    // input went away without being sent (purged, or read by a test), start over
+    if (seen < last.seen) m_count = 0;
+    else if (seen == last.seen) return;
+    else if (m_count == kMarks) { last.seen = seen; return; }
+  }
+
+  m_marks[(m_head + m_count) % kMarks] = { seen, nowUs };
+  m_count++;
+}
+
+uint32_t QueueDelay::sent(size_t n, uint32_t nowUs)
+{
+  m_sent += (uint32_t)n;
+  if (m_count == 0) return 0;
+
+  // drop observations that were sent in full, bytes read beyond the newest one
+  // arrived after it, so its time still bounds their wait
+  uint32_t since = m_marks[m_head].us;
+  while (m_count && (int32_t)(m_marks[m_head].seen - m_sent) < 0) {
+    since = m_marks[m_head].us;
+    m_head = (m_head + 1) % kMarks;
+    m_count--;
+  }
+  if (m_count) {
+    since = m_marks[m_head].us;
+    if (m_marks[m_head].seen == m_sent) {
+      m_head = (m_head + 1) % kMarks;
+      m_count--;
+    }
+  }
+
+  return nowUs - since;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Building blocks for the per bridge network send scheduling. Plain C++ with
+// no Arduino dependencies, callers pass the time in.
+
+// Byte rate limiter. Tokens refill continuously at the configured rate up to
+// one burst; a send may overdraw the bucket (transforms can expand what was
+// read), the debt is paid back before anything else goes out.
+class TokenBucket {
+  public:
+    // bytes per second, 0 never limits
+    void configure(uint32_t rate, uint32_t nowUs);
+    uint32_t rate() const { return m_rate; }
+
+    // bytes that may be sent now
+    size_t available(uint32_t nowUs);
+    void consume(size_t n);
+
+  private:
+    static constexpr uint32_t kMinBurst = 512;   // one bridge buffer, so slow rates still move whole reads
+
+    uint32_t m_rate = 0;
+    int64_t m_burst = 0;     // in byte microseconds, like m_tokens
+    int64_t m_tokens = 0;
+    uint32_t m_lastUs = 0;
+};
+
+// How long received bytes wait before they are handed to the network.
+//
+// Each time the sender looks at its input it records how many bytes it has
+// seen so far, with the time; when bytes go out, the oldest observation that
+// already included the last of them gives their wait. A few observations are
+// enough, when they run out the newest one absorbs the rest and the estimate
+// errs on the long side.
+class QueueDelay {
+  public:
+    // pending bytes waiting in the input right now
+    void observe(size_t pending, uint32_t nowUs);
+    // n of them were sent, returns how long the last one waited
+    uint32_t sent(size_t n, uint32_t nowUs);
+    void reset() { m_count = 0; }
+
+  private:
+    static constexpr uint8_t kMarks = 8;
+
+    struct Mark {
+      uint32_t seen;   // bytes seen up to this observation, sent ones included
+      uint32_t us;
+    };
+
+    Mark m_marks[kMarks];
+    uint8_t m_head = 0;
+    uint8_t m_count = 0;
+    uint32_t m_sent = 0;
+};
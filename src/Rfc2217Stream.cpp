@@ -0,0 +1,330 @@
+#include <ArduinoLog.h>
+
+#include "Rfc2217Stream.h"
+#include "SerialBridge.h"
+
+// telnet commands
+static constexpr uint8_t TN_SE = 240;
+static constexpr uint8_t TN_SB = 250;
+static constexpr uint8_t TN_WILL = 251;
+static constexpr uint8_t TN_WONT = 252;
+static constexpr uint8_t TN_DO = 253;
+static constexpr uint8_t TN_DONT = 254;
+static constexpr uint8_t TN_IAC = 255;
+
+// telnet options
+static constexpr uint8_t OPT_BINARY = 0;
+static constexpr uint8_t OPT_SGA = 3;
+static constexpr uint8_t OPT_COM_PORT = 44;
+
+// com port option commands, client to server (server replies add 100)
+static constexpr uint8_t CPO_SET_BAUDRATE = 1;
+static constexpr uint8_t CPO_SET_DATASIZE = 2;
+static constexpr uint8_t CPO_SET_PARITY = 3;
+static constexpr uint8_t CPO_SET_STOPSIZE = 4;
+static constexpr uint8_t CPO_SET_CONTROL = 5;
+static constexpr uint8_t CPO_NOTIFY_LINESTATE = 6;
+static constexpr uint8_t CPO_NOTIFY_MODEMSTATE = 7;
+static constexpr uint8_t CPO_FLOWCONTROL_SUSPEND = 8;
+static constexpr uint8_t CPO_FLOWCONTROL_RESUME = 9;
+static constexpr uint8_t CPO_SET_LINESTATE_MASK = 10;
+static constexpr uint8_t CPO_SET_MODEMSTATE_MASK = 11;
+static constexpr uint8_t CPO_PURGE_DATA = 12;
+static constexpr uint8_t CPO_SERVER_OFFSET = 100;
+
+// there are no modem lines wired, report carrier, DSR and CTS as asserted
+static constexpr uint8_t kModemState = 0x80 | 0x20 | 0x10;
+
+Rfc2217Stream::Rfc2217Stream(Client& client, SerialBridge& bridge) :
+m_client(client),
+m_bridge(bridge)
+{
+  // never let Stream::readBytes() wait on bytes that turned out to be commands
+  setTimeout(0);
+}
+
+void Rfc2217Stream::begin()
+{
+  // ask for the com port option and an 8-bit clean channel both ways
+  m_options[optionIndex(OPT_COM_PORT)] |= kRemote;
+  m_options[optionIndex(OPT_BINARY)] |= kLocal | kRemote;
+  m_options[optionIndex(OPT_SGA)] |= kLocal | kRemote;
+  sendCommand(TN_DO, OPT_COM_PORT);
+  sendCommand(TN_WILL, OPT_BINARY);
+  sendCommand(TN_DO, OPT_BINARY);
+  sendCommand(TN_WILL, OPT_SGA);
+  sendCommand(TN_DO, OPT_SGA);
+}
+
+int Rfc2217Stream::available()
+{
+  return (m_peeked >= 0 ? 1 : 0) + (int)(m_rxLen - m_rxPos) + m_client.available();
+}
+
+int Rfc2217Stream::read()
+{
+  if (m_peeked >= 0) {
+    int c = m_peeked;
+    m_peeked = -1;
+    return c;
+  }
+  return nextData();
+}
+
+int Rfc2217Stream::peek()
+{
+  if (m_peeked < 0) m_peeked = nextData();
+  return m_peeked;
+}
+
+size_t Rfc2217Stream::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t Rfc2217Stream::write(const uint8_t* buf, size_t size)
+{
+  // send data in spans, doubling every IAC
+  size_t start = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (buf[i] != TN_IAC) continue;
+    m_client.write(buf + start, i - start + 1);
+    m_client.write(TN_IAC);
+    start = i + 1;
+  }
+  if (start < size) m_client.write(buf + start, size - start);
+  return size;
+}
+
+int Rfc2217Stream::readRaw()
+{
+  if (m_rxPos >= m_rxLen) {
+    if (m_client.available() <= 0) return -1;
+    int r = m_client.read(m_rx, sizeof(m_rx));
+    if (r <= 0) return -1;
+    m_rxLen = (size_t)r;
+    m_rxPos = 0;
+  }
+  return m_rx[m_rxPos++];
+}
+
+int Rfc2217Stream::nextData()
+{
+  int b;
+  while ((b = readRaw()) >= 0) {
+    switch (m_state) {
+      case ST_DATA:
+        if (b != TN_IAC) return b;
+        m_state = ST_IAC;
+        break;
+      case ST_IAC:
+        m_state = ST_DATA;
+        if (b == TN_IAC) return b;
+        else if (b == TN_WILL) m_state = ST_WILL;
+        else if (b == TN_WONT) m_state = ST_WONT;
+        else if (b == TN_DO) m_state = ST_DO;
+        else if (b == TN_DONT) m_state = ST_DONT;
+        else if (b == TN_SB) { m_sbLen = 0; m_state = ST_SB; }
+        // anything else (NOP, AYT, GA...) is dropped
+        break;
+      case ST_WILL:
+      case ST_WONT:
+      case ST_DO:
+      case ST_DONT:
+        handleOption(m_state, (uint8_t)b);
+        m_state = ST_DATA;
+        break;
+      case ST_SB:
+        if (b == TN_IAC) m_state = ST_SB_IAC;
+        else if (m_sbLen < sizeof(m_sb)) m_sb[m_sbLen++] = (uint8_t)b;
+        break;
+      case ST_SB_IAC:
+        if (b == TN_SE) {
+          handleSubnegotiation();
+          m_state = ST_DATA;
+        } else if (b == TN_IAC) {
+          if (m_sbLen < sizeof(m_sb)) m_sb[m_sbLen++] = TN_IAC;
+          m_state = ST_SB;
+        } else {
+          m_state = ST_DATA;
+        }
+        break;
+    }
+  }
+  return -1;
+}
+
+int Rfc2217Stream::optionIndex(uint8_t opt)
+{
+  switch (opt) {
+    case OPT_BINARY: return 0;
+    case OPT_SGA: return 1;
+    case OPT_COM_PORT: return 2;
+    default: return -1;
+  }
+}
+
+void Rfc2217Stream::handleOption(State verb, uint8_t opt)
+{
+  int i = optionIndex(opt);
+  // the server never enables com port control on its own side
+  bool localOk = i >= 0 && opt != OPT_COM_PORT;
+
+  switch (verb) {
+    case ST_WILL:
+      if (i < 0) {
+        sendCommand(TN_DONT, opt);
+        break;
+      }
+      if (!(m_options[i] & kRemote)) {
+        m_options[i] |= kRemote;
+        sendCommand(TN_DO, opt);
+      }
+      if (opt == OPT_COM_PORT && !m_comPortActive) {
+        m_comPortActive = true;
+        Log.infoln("RFC2217(%s) com port control enabled", m_bridge.code().c_str());
+        sendComPort(CPO_NOTIFY_MODEMSTATE + CPO_SERVER_OFFSET, kModemState & m_modemStateMask);
+      }
+      break;
+    case ST_WONT:
+      if (i >= 0 && (m_options[i] & kRemote)) {
+        m_options[i] &= ~kRemote;
+        sendCommand(TN_DONT, opt);
+      }
+      if (opt == OPT_COM_PORT) m_comPortActive = false;
+      break;
+    case ST_DO:
+      if (!localOk) {
+        sendCommand(TN_WONT, opt);
+      } else if (!(m_options[i] & kLocal)) {
+        m_options[i] |= kLocal;
+        sendCommand(TN_WILL, opt);
+      }
+      break;
+    case ST_DONT:
+      if (i >= 0 && (m_options[i] & kLocal)) {
+        m_options[i] &= ~kLocal;
+        sendCommand(TN_WONT, opt);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void Rfc2217Stream::handleSubnegotiation()
+{
+  if (m_sbLen < 2 || m_sb[0] != OPT_COM_PORT) return;
+
+  uint8_t cmd = m_sb[1];
+  const uint8_t* data = m_sb + 2;
+  size_t len = m_sbLen - 2;
+  uint8_t value = len ? data[0] : 0;
+  uint8_t reply = cmd + CPO_SERVER_OFFSET;
+
+  unsigned long baud = m_bridge.baud();
+  SerialBridge::SerialFormat fmt = m_bridge.format();
+  uint8_t bits = SerialBridge::dataBits(fmt);
+  char parity = SerialBridge::parity(fmt);
+  uint8_t stop = SerialBridge::stopBits(fmt);
+
+  switch (cmd) {
+    case CPO_SET_BAUDRATE: {
+      if (len < 4) return;
+      uint32_t req = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+      // zero is a query
+      if (req) m_bridge.applySerialConfig(req, fmt);
+      baud = m_bridge.baud();
+      uint8_t out[4] = { (uint8_t)(baud >> 24), (uint8_t)(baud >> 16), (uint8_t)(baud >> 8), (uint8_t)baud };
+      sendComPort(reply, out, sizeof(out));
+      break;
+    }
+    case CPO_SET_DATASIZE:
+      if (value >= 5 && value <= 8) m_bridge.applySerialConfig(baud, SerialBridge::makeFormat(value, parity, stop));
+      sendComPort(reply, SerialBridge::dataBits(m_bridge.format()));
+      break;
+    case CPO_SET_PARITY:
+      // 1 none, 2 odd, 3 even, mark and space are not supported
+      if (value >= 1 && value <= 3) m_bridge.applySerialConfig(baud, SerialBridge::makeFormat(bits, value == 1 ? 'N' : value == 2 ? 'O' : 'E', stop));
+      parity = SerialBridge::parity(m_bridge.format());
+      sendComPort(reply, parity == 'O' ? 2 : parity == 'E' ? 3 : 1);
+      break;
+    case CPO_SET_STOPSIZE:
+      // 1 and 2 stop bits, 1.5 is not supported
+      if (value == 1 || value == 2) m_bridge.applySerialConfig(baud, SerialBridge::makeFormat(bits, parity, value));
+      sendComPort(reply, SerialBridge::stopBits(m_bridge.format()));
+      break;
+    case CPO_SET_CONTROL:
+      switch (value) {
+        case 0: break;                                              // query outbound flow control
+        case 1: m_bridge.setHwFlowControl(false); break;            // none
+        case 3: m_bridge.setHwFlowControl(true); break;             // hardware
+        case 4: value = m_break ? 5 : 6; break;                     // query break
+        case 5: case 6: m_break = (value == 5); break;
+        case 7: value = m_dtr ? 8 : 9; break;                       // query DTR
+        case 8: case 9: m_dtr = (value == 8); break;
+        case 10: value = m_rts ? 11 : 12; break;                    // query RTS
+        case 11: case 12: m_rts = (value == 11); break;
+        case 13: value = m_bridge.hwFlowControl() ? 16 : 14; break; // query inbound flow control
+        default: break;
+      }
+      // flow control requests are answered with the mode actually in effect
+      if (value <= 3) value = m_bridge.hwFlowControl() ? 3 : 1;
+      else if (value >= 14 && value <= 19) value = m_bridge.hwFlowControl() ? 16 : 14;
+      sendComPort(reply, value);
+      break;
+    case CPO_NOTIFY_LINESTATE:
+      // clients poll with an empty notify, the uart has no line errors to report here
+      sendComPort(reply, 0);
+      break;
+    case CPO_NOTIFY_MODEMSTATE:
+      sendComPort(reply, kModemState & m_modemStateMask);
+      break;
+    case CPO_FLOWCONTROL_SUSPEND:
+      m_suspended = true;
+      break;
+    case CPO_FLOWCONTROL_RESUME:
+      m_suspended = false;
+      break;
+    case CPO_SET_LINESTATE_MASK:
+      m_lineStateMask = value;
+      sendComPort(reply, value);
+      break;
+    case CPO_SET_MODEMSTATE_MASK:
+      m_modemStateMask = value;
+      sendComPort(reply, value);
+      break;
+    case CPO_PURGE_DATA:
+      // 1 rx buffer, 2 tx buffer, 3 both
+      m_bridge.purgeSerial(value & 1, value & 2);
+      sendComPort(reply, value);
+      break;
+    default:
+      Log.warningln("RFC2217(%s) unknown com port command %u", m_bridge.code().c_str(), cmd);
+      break;
+  }
+}
+
+void Rfc2217Stream::sendCommand(uint8_t verb, uint8_t opt)
+{
+  uint8_t cmd[3] = { TN_IAC, verb, opt };
+  m_client.write(cmd, sizeof(cmd));
+}
+
+void Rfc2217Stream::sendComPort(uint8_t cmd, const uint8_t* data, size_t len)
+{
+  // IAC SB option cmd, up to 4 value bytes each possibly doubled, IAC SE
+  uint8_t out[4 + 2 * 4 + 2];
+  size_t n = 0;
+  out[n++] = TN_IAC;
+  out[n++] = TN_SB;
+  out[n++] = OPT_COM_PORT;
+  out[n++] = cmd;
+  for (size_t i = 0; i < len && i < 4; ++i) {
+    out[n++] = data[i];
+    if (data[i] == TN_IAC) out[n++] = TN_IAC;
+  }
+  out[n++] = TN_IAC;
+  out[n++] = TN_SE;
+  m_client.write(out, n);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+class SerialBridge;
+
+// Telnet stream with the RFC 2217 COM port control option. Wraps a connected
+// client, strips and answers telnet commands on the way in and escapes IAC
+// on the way out, applying port changes live on the bridge.
+class Rfc2217Stream : public Stream {
+  public:
+    Rfc2217Stream(Client& client, SerialBridge& bridge);
+
+    void begin();
+    bool suspended() { return m_suspended; }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buf, size_t size) override;
+    void flush() override { m_client.flush(); }
+
+  private:
+    enum State : uint8_t {
+      ST_DATA,
+      ST_IAC,
+      ST_WILL,
+      ST_WONT,
+      ST_DO,
+      ST_DONT,
+      ST_SB,
+      ST_SB_IAC
+    };
+
+    // option flags
+    static constexpr uint8_t kLocal = 0x01;
+    static constexpr uint8_t kRemote = 0x02;
+
+    Client& m_client;
+    SerialBridge& m_bridge;
+
+    State m_state = ST_DATA;
+    uint8_t m_options[4] = {};
+    uint8_t m_sb[16];
+    size_t m_sbLen = 0;
+    bool m_suspended = false;
+    bool m_comPortActive = false;
+    uint8_t m_modemStateMask = 0xFF;
+    uint8_t m_lineStateMask = 0;
+    uint8_t m_dtr = 1;
+    uint8_t m_rts = 1;
+    uint8_t m_break = 0;
+
+    uint8_t m_rx[128];
+    size_t m_rxLen = 0;
+    size_t m_rxPos = 0;
+    int m_peeked = -1;
+
+    int readRaw();
+    int nextData();
+    int optionIndex(uint8_t opt);
+    void handleOption(State verb, uint8_t opt);
+    void handleSubnegotiation();
+    void sendCommand(uint8_t verb, uint8_t opt);
+    void sendComPort(uint8_t cmd, const uint8_t* data, size_t len);
+    void sendComPort(uint8_t cmd, uint8_t value) { sendComPort(cmd, &value, 1); }
+};
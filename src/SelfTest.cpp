@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <string.h>
+
+#include "SelfTest.h"
+
+static constexpr uint8_t kMagic0 = 0xA5;
+static constexpr uint8_t kMagic1 = 0x5A;
+
+// sequence numbers further ahead than this are treated as a damaged header
+static constexpr uint32_t kMaxSeqJump = 1024;
+
+// a frame failing its crc16 with more bits off than this has slipped, a byte
+// shifted in or out scrambles about half the bits after it
+static constexpr uint32_t kMaxBitErrors = 4;
+
+static inline uint32_t readLe32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// CRC-8 (poly 0x07) guarding sequence number and timestamp
+static uint8_t crc8(const uint8_t* p, size_t len)
+{
+  uint8_t crc = 0;
+  while (len--) {
+    crc ^= *p++;
+    for (int b = 0; b < 8; ++b) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+// CRC-16/CCITT (poly 0x1021) over the whole frame after the magic
+static uint16_t crc16(const uint8_t* p, size_t len, uint16_t crc = 0xFFFF)
+{
+  while (len--) {
+    crc ^= (uint16_t)(*p++) << 8;
+    for (int b = 0; b < 8; ++b) crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+static inline void writeLe32(uint8_t* p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+PrbsTester::PrbsTester(uint32_t rate) :
+m_rate(rate ? rate : 1)
+{
+  m_latency.reserve(kLatencySamples);
+}
+
+void PrbsTester::fillPayload(uint32_t seq, uint8_t* out)
+{
+  // PRBS-15 (x^15 + x^14 + 1), any non zero seed
+  uint16_t state = (uint16_t)(((seq * 2654435761u) >> 17) | 1);
+  for (size_t i = 0; i < kPayloadSize; ++i) {
+    uint8_t byte = 0;
+    for (int b = 0; b < 8; ++b) {
+      uint16_t bit = ((state >> 14) ^ (state >> 13)) & 1;
+      state = (uint16_t)(((state << 1) | bit) & 0x7FFF);
+      byte = (uint8_t)((byte << 1) | bit);
+    }
+    out[i] = byte;
+  }
+}
+
+void PrbsTester::begin(uint32_t nowUs)
+{
+  m_startUs = nowUs;
+  m_lastUs = nowUs;
+  m_budget = 0;
+  m_txSeq = 0;
+  m_rxSeq = 0;
+  m_frameLen = 0;
+  m_res = {};
+  m_latency.clear();
+  m_latencyNext = 0;
+}
+
+size_t PrbsTester::generate(uint8_t* buf, size_t cap, uint32_t nowUs)
+{
+  // token bucket, at most a quarter second of backlog
+  m_budget += (uint64_t)(uint32_t)(nowUs - m_lastUs) * m_rate;
+  m_lastUs = nowUs;
+  uint64_t maxBudget = (uint64_t)m_rate * 250000 + (uint64_t)kFrameSize * 1000000;
+  if (m_budget > maxBudget) m_budget = maxBudget;
+
+  size_t len = 0;
+  while (len + kFrameSize <= cap && m_budget >= (uint64_t)kFrameSize * 1000000) {
+    uint8_t* f = buf + len;
+    f[0] = kMagic0;
+    f[1] = kMagic1;
+    writeLe32(f + 2, m_txSeq);
+    writeLe32(f + 6, nowUs);
+    f[10] = crc8(f + 2, 8);
+    fillPayload(m_txSeq, f + kHeaderSize);
+    uint16_t crc = crc16(f + 2, kFrameSize - 2 - kTrailerSize);
+    f[kFrameSize - 2] = (uint8_t)crc;
+    f[kFrameSize - 1] = (uint8_t)(crc >> 8);
+    m_txSeq++;
+    m_budget -= (uint64_t)kFrameSize * 1000000;
+    len += kFrameSize;
+  }
+
+  m_res.bytesSent += len;
+  return len;
+}
+
+void PrbsTester::receive(const uint8_t* buf, size_t len, uint32_t nowUs)
+{
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t b = buf[i];
+
+    // hunt for the two byte header
+    if (m_frameLen == 0 && b != kMagic0) { m_res.syncSlips++; continue; }
+    if (m_frameLen == 1 && b != kMagic1) {
+      m_res.syncSlips++;
+      m_frameLen = (b == kMagic0) ? 1 : 0;
+      continue;
+    }
+
+    m_frame[m_frameLen++] = b;
+    if (m_frameLen == kFrameSize) {
+      if (checkFrame(nowUs)) m_frameLen = 0;
+      else resync();
+    }
+  }
+}
+
+bool PrbsTester::checkFrame(uint32_t nowUs)
+{
+  uint32_t seq = readLe32(m_frame + 2);
+  uint32_t txUs = readLe32(m_frame + 6);
+
+  // a sequence number from the past or too far ahead means the header is damaged
+  if (crc8(m_frame + 2, 8) != m_frame[10] || seq < m_rxSeq || seq - m_rxSeq > kMaxSeqJump || seq >= m_txSeq) {
+    m_res.framesBad++;
+    return false;
+  }
+
+  uint8_t expected[kPayloadSize];
+  fillPayload(seq, expected);
+  uint32_t errors = 0;
+  uint16_t rxCrc = (uint16_t)(m_frame[kFrameSize - 2] | (m_frame[kFrameSize - 1] << 8));
+  if (crc16(m_frame + 2, kFrameSize - 2 - kTrailerSize) != rxCrc) {
+    // count flipped bits in the payload and the trailer against what was sent
+    const uint8_t* payload = m_frame + kHeaderSize;
+    for (size_t i = 0; i < kPayloadSize; ++i) {
+      errors += (uint32_t)__builtin_popcount(expected[i] ^ payload[i]);
+    }
+    uint16_t txCrc = crc16(expected, kPayloadSize, crc16(m_frame + 2, kHeaderSize - 2));
+    errors += (uint32_t)__builtin_popcount(txCrc ^ rxCrc);
+    if (errors > kMaxBitErrors) {
+      m_res.framesBad++;
+      return false;
+    }
+  }
+
+  m_res.bytesLost += (seq - m_rxSeq) * (uint32_t)kFrameSize;
+  m_rxSeq = seq + 1;
+
+  m_res.bitsChecked += (kPayloadSize + kTrailerSize) * 8;
+  m_res.bitErrors += errors;
+  m_res.bytesVerified += kFrameSize;
+  m_res.framesOk++;
+
+  // keep the most recent samples
+  uint32_t latency = nowUs - txUs;
+  if (m_latency.size() < kLatencySamples) m_latency.push_back(latency);
+  else m_latency[m_latencyNext] = latency;
+  m_latencyNext = (m_latencyNext + 1) % kLatencySamples;
+  if (latency > m_res.latencyMaxUs) m_res.latencyMaxUs = latency;
+  return true;
+}
+
+void PrbsTester::resync()
+{
+  // the next frame may already have started inside the bad one, keep it from its magic on
+  size_t k = 1;
+  while (k < kFrameSize && !(m_frame[k] == kMagic0 && (k + 1 == kFrameSize || m_frame[k + 1] == kMagic1))) ++k;
+  m_res.syncSlips += (uint32_t)k;
+  m_frameLen = kFrameSize - k;
+  memmove(m_frame, m_frame + k, m_frameLen);
+}
+
+SelfTestResults PrbsTester::results(uint32_t nowUs) const
+{
+  SelfTestResults res = m_res;
+  // anything still missing once the caller stopped and drained is lost
+  res.bytesLost += (m_txSeq - m_rxSeq) * (uint32_t)kFrameSize;
+  uint32_t elapsedUs = nowUs - m_startUs;
+  res.elapsedMs = elapsedUs / 1000;
+  res.throughputBps = elapsedUs ? (uint32_t)((uint64_t)res.bytesVerified * 1000000 / elapsedUs) : 0;
+  res.bitErrorRate = res.bitsChecked ? (float)res.bitErrors / (float)res.bitsChecked : 0.0f;
+  res.byteLossRate = res.bytesSent ? (float)res.bytesLost / (float)res.bytesSent : 0.0f;
+
+  if (!m_latency.empty()) {
+    std::vector<uint32_t> sorted(m_latency);
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    res.latencyP50Us = sorted[(n - 1) * 50 / 100];
+    res.latencyP95Us = sorted[(n - 1) * 95 / 100];
+    res.latencyP99Us = sorted[(n - 1) * 99 / 100];
+  }
+  return res;
+}
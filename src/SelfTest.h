@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Loopback traffic generator and checker. Plain C++ with no Arduino
+// dependencies, time is passed in as a free running microsecond counter.
+//
+// Traffic is a stream of 64 byte frames:
+//   [0xA5][0x5A][seq u32 le][tx time us u32 le][crc8][51 bytes PRBS-15 seeded by seq][crc16 le]
+// The crc8 guards the header, the crc16 everything after the magic. A frame
+// that fails its crc16 with only a few bits off the regenerated payload is
+// scored as bit errors; one that is further off slipped (bytes were dropped
+// or inserted), it is counted lost and the checker resyncs on the next magic
+// inside it. Lost frames show up as sequence gaps.
+
+struct SelfTestResults {
+  uint32_t elapsedMs;
+  uint32_t bytesSent;
+  uint32_t bytesVerified;
+  uint32_t bytesLost;
+  uint32_t framesOk;
+  uint32_t framesBad;       // damaged header or slipped, their bytes count as lost
+  uint32_t syncSlips;       // bytes skipped looking for a frame header
+  uint64_t bitsChecked;
+  uint64_t bitErrors;
+  uint32_t throughputBps;   // verified bytes per second
+  float bitErrorRate;
+  float byteLossRate;
+  uint32_t latencyP50Us;
+  uint32_t latencyP95Us;
+  uint32_t latencyP99Us;
+  uint32_t latencyMaxUs;
+};
+
+class PrbsTester {
+  public:
+    static constexpr size_t kFrameSize = 64;
+    static constexpr size_t kHeaderSize = 11;
+    static constexpr size_t kTrailerSize = 2;
+    static constexpr size_t kPayloadSize = kFrameSize - kHeaderSize - kTrailerSize;
+
+    // rate in bytes per second
+    explicit PrbsTester(uint32_t rate);
+
+    void begin(uint32_t nowUs);
+    // whole frames due by now, up to cap bytes
+    size_t generate(uint8_t* buf, size_t cap, uint32_t nowUs);
+    void receive(const uint8_t* buf, size_t len, uint32_t nowUs);
+    SelfTestResults results(uint32_t nowUs) const;
+
+    static void fillPayload(uint32_t seq, uint8_t* out);
+
+  private:
+    static constexpr size_t kLatencySamples = 512;
+
+    uint32_t m_rate;
+    uint32_t m_startUs = 0;
+    uint32_t m_lastUs = 0;
+    uint64_t m_budget = 0;   // bytes allowed so far, scaled by 1e6
+    uint32_t m_txSeq = 0;
+    uint32_t m_rxSeq = 0;
+
+    uint8_t m_frame[kFrameSize];
+    size_t m_frameLen = 0;
+
+    SelfTestResults m_res = {};
+    std::vector<uint32_t> m_latency;
+    size_t m_latencyNext = 0;
+
+    bool checkFrame(uint32_t nowUs);
+    void resync();
+};
@@ -1,10 +1,17 @@
 #include <ArduinoLog.h>
 #include <HardwareSerial.h>
 #include <WiFi.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
 #include <freertos/FreeRTOS.h>
+#include <atomic>
 #include <mutex>
+#include <vector>
 
 #include "SerialBridge.h"
+#include "Rfc2217Stream.h"
+#include "MuxServer.h"
+#include "Trace.h"
 
 #if HAS_CLASSIC_BT
   #include <BluetoothSerial.h>
@@ -19,13 +26,29 @@
 
 std::mutex g_bleMutex;
 bool g_bleInitialized = false;
+std::mutex g_restartMutex;
+// held across a whole stop, apply, start so restarts of a bridge and its peer cannot interleave
+std::mutex g_applyMutex;
+// micros() of the last network send by a latency bridge, bulk bridges hold back for a while after it
+std::atomic<uint32_t> g_latencySentUs{0};
+
+// auto detect candidates, most common first
+static constexpr unsigned long kAutoBaudRates[] = { 115200, 9600, 57600, 38400, 19200, 230400, 4800, 460800, 921600, 2400, 1200 };
+static constexpr size_t kAutoBaudLockBytes = 48;     // clean bytes needed to lock without finishing the sweep
+static constexpr uint32_t kAutoBaudSampleMs = 120;   // listen time per candidate
+static constexpr uint32_t kLatencyHoldOffUs = 10000;  // bulk sends wait this long after a latency bridge sent
+static constexpr uint32_t kMaxDeferUs = 20000;        // longest a bulk send waits for latency bridges
+static constexpr uint32_t kThrottleHoldUs = 100000;   // rate limited data waits about one bucket refill
+static constexpr size_t kMinRxBuffer = 512;           // one pump read on top of the held back data
+static constexpr size_t kMaxRxBuffer = 8192;
 void initBle(String name);
 
-SerialBridge::SerialBridge(String name, String code, HardwareSerial& hwSerial) :
+SerialBridge::SerialBridge(String name, String code, HardwareSerial& hwSerial, int8_t uartNum) :
 m_name(name),
 m_code(code),
 m_streamType(HW_SERIAL),
-m_stream(&hwSerial) {}
+m_stream(&hwSerial),
+m_uartNum(uartNum) {}
 
 SerialBridge::SerialBridge(String name, String code, HWCDC& hwCdc) :
 m_name(name),
@@ -35,25 +58,126 @@ m_stream(&hwCdc) {}
 
 void SerialBridge::start()
 {
+  if (m_running) return;
+
   // load config
-  if (!loadConfig()) {
+  if (!m_configLoaded && !loadConfig()) {
     // return;
   }
+  if (m_peer && !m_peer->m_configLoaded) m_peer->loadConfig();
+
+  // a cross-connecting peer owns our stream, leave it alone
+  if (m_peer && m_peer->m_bridgeType == BridgeType::SERIAL_PEER &&
+      (m_bridgeType != BridgeType::SERIAL_PEER || m_peer->m_crossConnected)) {
+    Log.infoln("SerialBridge(%s) cross-connected by %s, not starting", m_code.c_str(), m_peer->m_code.c_str());
+    return;
+  }
 
   // create bridge task
+  m_stopRequested = false;
+  m_running = true;
+  m_task = nullptr;
   if (m_bridgeType == BridgeType::TCP_SERVER) {
-    xTaskCreate((TaskFunction_t)(&SerialBridge::tcpServerTask), "TcpServerBridge", 2048, this, 1, nullptr);
+    xTaskCreate((TaskFunction_t)(&SerialBridge::tcpServerTask), "TcpServerBridge", 2048, this, taskPriority(m_qos), &m_task);
   } else if (m_bridgeType == BridgeType::TCP_CLIENT) {
-    xTaskCreate((TaskFunction_t)(&SerialBridge::tcpClientTask), "TcpClientBridge", 2048, this, 1, nullptr);
+    xTaskCreate((TaskFunction_t)(&SerialBridge::tcpClientTask), "TcpClientBridge", 2048, this, taskPriority(m_qos), &m_task);
   } else if (m_bridgeType == BridgeType::BLUETOOTH) {
-    xTaskCreate((TaskFunction_t)(&SerialBridge::bluetoothTask), "BluetoothBridge", 2048, this, 1, nullptr);
+    xTaskCreate((TaskFunction_t)(&SerialBridge::bluetoothTask), "BluetoothBridge", 2048, this, taskPriority(m_qos), &m_task);
   } else if (m_bridgeType == BridgeType::BLE) {
-    xTaskCreate((TaskFunction_t)(&SerialBridge::bleTask), "BLEBridge", 4096, this, 1, nullptr);
+    xTaskCreate((TaskFunction_t)(&SerialBridge::bleTask), "BLEBridge", 4096, this, taskPriority(m_qos), &m_task);
+  } else if (m_bridgeType == BridgeType::SERIAL_PEER) {
+    if (!m_peer) {
+      Log.errorln("SerialBridge(%s) has no peer to cross-connect, cannot start", m_code.c_str());
+      m_running = false;
+      return;
+    }
+    m_crossConnected = true;
+    xTaskCreate((TaskFunction_t)(&SerialBridge::serialPeerTask), "SerialPeerBridge", 2048, this, taskPriority(m_qos), &m_task);
+  } else if (m_bridgeType == BridgeType::MUX) {
+    // all multiplexed bridges are served by the shared mux task
+    if (!MuxServer::instance().attach(this)) m_running = false;
   } else {
     Log.errorln("SerialBridge(%s) unknown bridge type, cannot start", m_code.c_str());
+    m_running = false;
   }
 }
 
+bool SerialBridge::stop()
+{
+  if (!m_running) return true;
+
+  // the BLE stack cannot be torn down and brought back up again
+  if (m_bridgeType == BridgeType::BLE) {
+    Log.warningln("SerialBridge(%s) BLE bridge cannot be stopped", m_code.c_str());
+    return false;
+  }
+  if (m_selfTestRunning || m_autoBaudRunning) {
+    Log.warningln("SerialBridge(%s) busy with a test, cannot stop", m_code.c_str());
+    return false;
+  }
+
+  Log.infoln("SerialBridge(%s) stopping...", m_code.c_str());
+  if (m_bridgeType == BridgeType::MUX) {
+    MuxServer::instance().detach(this);
+    m_running = false;
+    return true;
+  }
+
+  // tasks check the flag in all their loops, a pending connect may take a few seconds
+  m_stopRequested = true;
+  uint32_t start = millis();
+  while (m_running && millis() - start < 5000) delay(10);
+  if (m_running) {
+    Log.errorln("SerialBridge(%s) task did not stop", m_code.c_str());
+    m_stopRequested = false;
+    return false;
+  }
+  return true;
+}
+
+void SerialBridge::applyBridgeConfig(BridgeType bType, String host, ushort port, bool rfc2217)
+{
+  std::lock_guard<std::mutex> lock(g_applyMutex);
+
+  // a cross-connect owns both serial ports, switching into or out of it restarts the peer as well
+  bool cross = m_peer && (bType == BridgeType::SERIAL_PEER || m_bridgeType == BridgeType::SERIAL_PEER || m_peer->m_bridgeType == BridgeType::SERIAL_PEER);
+
+  if (!stop()) {
+    Log.noticeln("SerialBridge(%s) bridge settings take effect after restart", m_code.c_str());
+    return;
+  }
+  if (cross && !m_peer->stop()) {
+    Log.noticeln("SerialBridge(%s) bridge settings take effect after restart", m_code.c_str());
+    start();
+    return;
+  }
+
+  m_bridgeType = bType;
+  m_host = host;
+  m_port = port;
+  m_rfc2217 = rfc2217;
+  m_crossConnected = false;
+  takePendingSerialConfig();
+  if (cross) {
+    m_peer->m_crossConnected = false;
+    m_peer->takePendingSerialConfig();
+  }
+
+  Log.infoln("SerialBridge(%s) restarting as %s", m_code.c_str(), toCString(m_bridgeType));
+  start();
+  if (cross) m_peer->start();
+  m_configGeneration++;
+}
+
+void SerialBridge::takePendingSerialConfig()
+{
+  // no task is running, the next initStream() picks these up
+  if (!m_serialDirty) return;
+  m_serialDirty = false;
+  m_baud = m_pendingBaud;
+  m_fmt = m_pendingFmt;
+}
+
 bool SerialBridge::loadConfig()
 {
   Preferences prefs;
@@ -71,7 +195,19 @@ bool SerialBridge::loadConfig()
   m_fmt = static_cast<SerialFormat>(prefs.getUChar("fmt", static_cast<uint8_t>(SerialFormat::F8N1)));
   m_hasEcho = prefs.getBool("hecho", false);
   m_simulateEcho = prefs.getBool("secho", false);
+  m_rfc2217 = prefs.getBool("rfc2217", false);
+  m_rs485 = prefs.getBool("rs485", false);
+  m_dePin = prefs.getChar("depin", -1);
+  m_transforms[static_cast<uint8_t>(Direction::SERIAL_TO_LINK)].configure(prefs.getUChar("xfrx", 0));
+  m_transforms[static_cast<uint8_t>(Direction::LINK_TO_SERIAL)].configure(prefs.getUChar("xftx", 0));
+  m_qos = static_cast<QosClass>(prefs.getUChar("qos", static_cast<uint8_t>(QosClass::BULK)));
+  if (m_qos >= QosClass::COUNT) m_qos = QosClass::BULK;
+  m_rateLimit = prefs.getULong("rate", 0);
+  if (m_rateLimit && m_rateLimit < kMinRateLimit) m_rateLimit = kMinRateLimit;
+  if (m_rateLimit > kMaxRateLimit) m_rateLimit = kMaxRateLimit;
   prefs.end();
+  m_sendBucket.configure(m_rateLimit, micros());
+  m_configLoaded = true;
 
   // log loaded config
   Log.infoln("Loaded %s Preferences", m_code.c_str());
@@ -82,12 +218,27 @@ bool SerialBridge::loadConfig()
   Log.noticeln("Fmt: %s", toCString(m_fmt));
   Log.noticeln("Has Echo: %s", m_hasEcho ? "true" : "false");
   Log.noticeln("Simulate Echo: %s", m_simulateEcho ? "true" : "false");
+  Log.noticeln("RFC 2217: %s", m_rfc2217 ? "true" : "false");
+  Log.noticeln("RS-485: %s (DE pin %d)", m_rs485 ? "true" : "false", m_dePin);
+  Log.noticeln("Transforms: rx 0x%x, tx 0x%x", transforms(Direction::SERIAL_TO_LINK), transforms(Direction::LINK_TO_SERIAL));
 
   return ret;
 }
 
-void SerialBridge::setConfig(BridgeType bType, String host, ushort port, unsigned long baud, SerialFormat fmt, bool hasEcho, bool simulateEcho)
+bool SerialBridge::setConfig(BridgeType bType, String host, ushort port, unsigned long baud, SerialFormat fmt, bool hasEcho, bool simulateEcho, bool rfc2217, String* error)
 {
+  const char* invalid = nullptr;
+  if (!isSupported(bType)) invalid = "type not available on this device";
+  else if (host.length() > kMaxHostLength) invalid = "host too long";
+  else if (port == 0) invalid = "invalid port";
+  else if (baud < kMinBaud || baud > kMaxBaud) invalid = "invalid baud";
+  else if (fmt >= SerialFormat::COUNT) invalid = "invalid format";
+  if (invalid) {
+    Log.warningln("SerialBridge(%s) %s, settings not saved", m_code.c_str(), invalid);
+    if (error) *error = invalid;
+    return false;
+  }
+
   Preferences prefs;
 
   if (!prefs.begin(m_code.c_str(), false)) {
@@ -102,6 +253,7 @@ void SerialBridge::setConfig(BridgeType bType, String host, ushort port, unsigne
   Log.noticeln("Fmt: %s", toCString(fmt));
   Log.noticeln("Has Echo: %s", hasEcho ? "true" : "false");
   Log.noticeln("Simulate Echo: %s", simulateEcho ? "true" : "false");
+  Log.noticeln("RFC 2217: %s", rfc2217 ? "true" : "false");
 
   prefs.putUChar("type", static_cast<uint8_t>(bType));
   prefs.putString("host", host);
@@ -110,18 +262,310 @@ void SerialBridge::setConfig(BridgeType bType, String host, ushort port, unsigne
   prefs.putUChar("fmt", static_cast<uint8_t>(fmt));
   prefs.putBool("hecho", hasEcho);
   prefs.putBool("secho", simulateEcho);
+  prefs.putBool("rfc2217", rfc2217);
   prefs.end();
+
+  // serial settings apply live, the running task picks them up
+  m_hasEcho = hasEcho;
+  m_simulateEcho = simulateEcho;
+  m_pendingBaud = baud;
+  m_pendingFmt = fmt;
+  m_serialDirty = true;
+  m_configGeneration++;
+
+  // bridge settings restart only this bridge's task, from a task of its own so the caller is not held up
+  if (bType != m_bridgeType || host != m_host || port != m_port || rfc2217 != m_rfc2217) {
+    std::lock_guard<std::mutex> lock(g_restartMutex);
+    m_pendingType = bType;
+    m_pendingHost = host;
+    m_pendingPort = port;
+    m_pendingRfc2217 = rfc2217;
+    m_restartPending = true;
+    if (!m_restarting) {
+      m_restarting = true;
+      xTaskCreate((TaskFunction_t)(&SerialBridge::restartTask), "BridgeRestart", 3072, this, 1, nullptr);
+    }
+  }
+  return true;
+}
+
+void SerialBridge::restartTask()
+{
+  for (;;) {
+    BridgeType bType;
+    String host;
+    ushort port;
+    bool rfc2217;
+    {
+      std::lock_guard<std::mutex> lock(g_restartMutex);
+      if (!m_restartPending) {
+        m_restarting = false;
+        break;
+      }
+      m_restartPending = false;
+      bType = m_pendingType;
+      host = m_pendingHost;
+      port = m_pendingPort;
+      rfc2217 = m_pendingRfc2217;
+    }
+    applyBridgeConfig(bType, host, port, rfc2217);
+  }
+  TRACE_TASK_EXIT();
+  vTaskDelete(nullptr);
+}
+
+bool SerialBridge::isValidDePin(long pin)
+{
+  return pin == -1 || (pin >= 0 && pin < GPIO_NUM_MAX && GPIO_IS_VALID_OUTPUT_GPIO(pin));
+}
+
+bool SerialBridge::isSupported(BridgeType type)
+{
+  if (type == BridgeType::BLUETOOTH) return HAS_BLUETOOTH;
+  if (type == BridgeType::BLE) return HAS_BLE;
+  return type < BridgeType::COUNT;
+}
+
+void SerialBridge::setRs485Config(bool enable, int8_t dePin)
+{
+  if (!isValidDePin(dePin)) {
+    Log.warningln("SerialBridge(%s) invalid DE pin %d", m_code.c_str(), dePin);
+    return;
+  }
+
+  Preferences prefs;
+
+  if (!prefs.begin(m_code.c_str(), false)) {
+    Log.warningln("Unable to save %s Preferences", m_code.c_str());
+  }
+
+  Log.infoln("Saving %s Preferences", m_code.c_str());
+  Log.noticeln("RS-485: %s (DE pin %d)", enable ? "true" : "false", dePin);
+
+  prefs.putBool("rs485", enable);
+  prefs.putChar("depin", dePin);
+  prefs.end();
+
+  m_pendingRs485 = enable;
+  m_pendingDePin = dePin;
+  m_rs485Dirty = true;
+  m_configGeneration++;
+}
+
+void SerialBridge::setTransforms(uint8_t serialToLink, uint8_t linkToSerial)
+{
+  Preferences prefs;
+
+  if (!prefs.begin(m_code.c_str(), false)) {
+    Log.warningln("Unable to save %s Preferences", m_code.c_str());
+  }
+
+  Log.infoln("Saving %s Preferences", m_code.c_str());
+  Log.noticeln("Transforms: rx 0x%x, tx 0x%x", serialToLink, linkToSerial);
+
+  prefs.putUChar("xfrx", serialToLink);
+  prefs.putUChar("xftx", linkToSerial);
+  prefs.end();
+
+  m_pendingTransforms[static_cast<uint8_t>(Direction::SERIAL_TO_LINK)] = serialToLink;
+  m_pendingTransforms[static_cast<uint8_t>(Direction::LINK_TO_SERIAL)] = linkToSerial;
+  m_transformsDirty = true;
+  m_configGeneration++;
+}
+
+void SerialBridge::setQos(QosClass qos, uint32_t rateLimit)
+{
+  if (qos >= QosClass::COUNT) qos = QosClass::BULK;
+  if (rateLimit && rateLimit < kMinRateLimit) rateLimit = kMinRateLimit;
+  if (rateLimit > kMaxRateLimit) rateLimit = kMaxRateLimit;
+
+  Preferences prefs;
+
+  if (!prefs.begin(m_code.c_str(), false)) {
+    Log.warningln("Unable to save %s Preferences", m_code.c_str());
+  }
+
+  Log.infoln("Saving %s Preferences", m_code.c_str());
+  Log.noticeln("QoS: %s, rate limit %u B/s", toCString(qos), rateLimit);
+
+  prefs.putUChar("qos", static_cast<uint8_t>(qos));
+  prefs.putULong("rate", rateLimit);
+  prefs.end();
+
+  m_qos = qos;
+  m_rateLimit = rateLimit;
+  m_qosDirty = true;
+  m_configGeneration++;
+}
+
+void SerialBridge::serviceConfig()
+{
+  if (m_qosDirty) {
+    m_qosDirty = false;
+    m_sendBucket.configure(m_rateLimit, micros());
+    // mux channels share the mux task, it picks its own priority
+    if (m_task && m_task == xTaskGetCurrentTaskHandle()) vTaskPrioritySet(nullptr, taskPriority(m_qos));
+  }
+
+  if (m_transformsDirty) {
+    m_transformsDirty = false;
+    m_transforms[0].configure(m_pendingTransforms[0]);
+    m_transforms[1].configure(m_pendingTransforms[1]);
+  }
+
+  if (m_rs485Dirty) {
+    m_rs485Dirty = false;
+    if (m_rs485 && !m_rs485Hw && m_dePin >= 0 && m_dePin != m_pendingDePin) digitalWrite(m_dePin, LOW);
+    m_rs485 = m_pendingRs485;
+    m_dePin = m_pendingDePin;
+    applyRs485();
+  }
+
+  if (!m_serialDirty) return;
+  m_serialDirty = false;
+  if (m_pendingBaud != m_baud || m_pendingFmt != m_fmt) applySerialConfig(m_pendingBaud, m_pendingFmt);
+}
+
+void SerialBridge::setLink(LinkState state, uint32_t remoteIp, uint16_t remotePort)
+{
+  // the address goes first, readers only look at it once the state says connected
+  m_remoteIp = remoteIp;
+  m_remotePort = remotePort;
+  m_linkState = state;
+}
+
+String SerialBridge::remoteAddress()
+{
+  if (m_linkState != LinkState::CONNECTED) return "";
+  // cross-connected either way round, the other end is the peer's port
+  if (m_peer && (m_crossConnected || m_peer->m_crossConnected)) return m_peer->m_name;
+  if (m_remoteIp == 0) return "";
+  return IPAddress(m_remoteIp).toString() + ":" + String(m_remotePort);
+}
+
+void SerialBridge::applySerialConfig(unsigned long baud, SerialFormat fmt)
+{
+  if (baud < kMinBaud || baud > kMaxBaud || fmt >= SerialFormat::COUNT) {
+    Log.warningln("SerialBridge(%s) rejected serial config %u", m_code.c_str(), baud);
+    return;
+  }
+
+  configureUart(baud, fmt);
+  // also reached from rfc 2217 and auto detection, the ui shows the new line settings
+  m_configGeneration++;
+
+  Log.infoln("SerialBridge(%s) serial set to %u %s", m_code.c_str(), m_baud, toCString(m_fmt));
+}
+
+void SerialBridge::configureUart(unsigned long baud, SerialFormat fmt)
+{
+  bool fmtChanged = (fmt != m_fmt);
+  m_baud = baud;
+  m_fmt = fmt;
+
+  // the usb cdc baud rate is set by the host, nothing to do on our side
+  if (m_streamType != HW_SERIAL) return;
+
+  HardwareSerial* hw = static_cast<HardwareSerial*>(m_stream);
+  if (fmtChanged) {
+    // frame format needs a reinit, let pending tx drain first
+    hw->flush();
+    hw->begin(m_baud, toArduinoConfig(m_fmt));
+    if (m_rxTimeout) hw->setRxTimeout(m_rxTimeout);
+    if (m_hwFlowControl) hw->setHwFlowCtrlMode(UART_HW_FLOWCTRL_CTS_RTS);
+    applyRs485();
+  } else {
+    hw->updateBaudRate(m_baud);
+    // the uart mode survives a baud change, only the char time moves
+    m_charTimeUs = (frameBits(m_fmt) * 1000000UL + m_baud - 1) / m_baud;
+  }
+}
+
+void SerialBridge::applyRs485()
+{
+  if (m_streamType != HW_SERIAL) return;
+  HardwareSerial* hw = static_cast<HardwareSerial*>(m_stream);
+
+  // start + data + parity + stop bits, rounded up
+  m_charTimeUs = (frameBits(m_fmt) * 1000000UL + m_baud - 1) / m_baud;
+
+  bool wasHw = m_rs485Hw;
+  m_rs485Hw = false;
+  if (!m_rs485 || m_dePin < 0) {
+    if (wasHw) hw->setMode(UART_MODE_UART);
+    return;
+  }
+
+  // the uart's own half duplex mode drops DE right after the last stop bit, use it when we can
+  if (hw->setPins(-1, -1, -1, m_dePin) && hw->setMode(UART_MODE_RS485_HALF_DUPLEX)) {
+    m_rs485Hw = true;
+  } else {
+    pinMode(m_dePin, OUTPUT);
+    digitalWrite(m_dePin, LOW);
+  }
+
+  Log.infoln("SerialBridge(%s) RS-485 on DE pin %d (%s), char time %uus", m_code.c_str(), m_dePin, m_rs485Hw ? "uart" : "gpio", m_charTimeUs);
+}
+
+bool SerialBridge::setHwFlowControl(bool enable)
+{
+  if (m_streamType != HW_SERIAL) return false;
+  if (static_cast<HardwareSerial*>(m_stream)->setHwFlowCtrlMode(enable ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE)) {
+    m_hwFlowControl = enable;
+  }
+  return m_hwFlowControl == enable;
+}
+
+void SerialBridge::purgeSerial(bool rx, bool tx)
+{
+  // pending tx cannot be dropped through the Stream API, it is left to drain
+  (void)tx;
+  if (rx) {
+    while (m_stream->available() > 0) m_stream->read();
+  }
+}
+
+size_t SerialBridge::rxBufferSize()
+{
+  // data held back by the qos gate waits in the uart, size for the longest hold at line rate;
+  // a rate limit below the line rate needs flow control, without it the overruns show in the stats
+  uint32_t byteRate = m_baud / frameBits(m_fmt);
+  uint32_t holdUs = kMaxDeferUs + (m_rateLimit ? kThrottleHoldUs : 0);
+  size_t size = (size_t)((uint64_t)byteRate * holdUs / 1000000) + kMinRxBuffer;
+  return size > kMaxRxBuffer ? kMaxRxBuffer : size;
 }
 
-bool SerialBridge::initStream()
+bool SerialBridge::initStream(size_t bufferSize)
 {
   // begin stream with it's corresponding call
   if (m_streamType == HW_CDC) {
     Log.infoln("SerialBridge(%s) initializing HWCDC Serial...", m_code.c_str());
+    if (bufferSize) {
+      static_cast<HWCDC*>(m_stream)->setRxBufferSize(bufferSize);
+      static_cast<HWCDC*>(m_stream)->setTxBufferSize(bufferSize);
+    }
     static_cast<HWCDC*>(m_stream)->begin(m_baud);
   } else if (m_streamType == HW_SERIAL) {
     Log.infoln("SerialBridge(%s) initializing HW Serial...", m_code.c_str());
-    static_cast<HardwareSerial*>(m_stream)->begin(m_baud, toArduinoConfig(m_fmt));
+    HardwareSerial* hw = static_cast<HardwareSerial*>(m_stream);
+    size_t rxSize = bufferSize ? bufferSize : rxBufferSize();
+    if (rxSize != m_rxBufferSize) {
+      // buffer sizes only take effect before begin(), a running port has to end first
+      hw->end();
+      hw->setRxBufferSize(rxSize);
+      if (bufferSize) hw->setTxBufferSize(bufferSize);
+      m_rxBufferSize = rxSize;
+      Log.infoln("SerialBridge(%s) rx buffer %u bytes", m_code.c_str(), rxSize);
+    }
+    hw->begin(m_baud, toArduinoConfig(m_fmt));
+    if (m_rxTimeout) hw->setRxTimeout(m_rxTimeout);
+    applyRs485();
+    // runs on the uart event task, only counts
+    hw->onReceiveError([this](hardwareSerial_error_t err) {
+      if (err == UART_BUFFER_FULL_ERROR || err == UART_FIFO_OVF_ERROR) m_stats.serialOverruns++;
+      else if (err == UART_FRAME_ERROR || err == UART_BREAK_ERROR) m_frameErrors++;
+      else if (err == UART_PARITY_ERROR) m_parityErrors++;
+    });
   } else {
     Log.errorln("SerialBridge(%s) unknown stream type, skipping initialization...", m_code.c_str());
     return false;
@@ -139,37 +583,61 @@ void SerialBridge::tcpServerTask()
   WiFiServer server(m_port, 1);
   uint8_t buffer[512];
 
-  for (;;) 
+  while (!m_stopRequested) 
   {
     // wait for WiFi
-    while (WiFi.status() != WL_CONNECTED) { delay(250); }
+    setLink(LinkState::WAITING);
+    while (WiFi.status() != WL_CONNECTED && !m_stopRequested) { delay(250); }
+    if (m_stopRequested) break;
     server.begin();
     server.setNoDelay(true);
+    setLink(LinkState::LISTENING);
 
-    while (WiFi.status() == WL_CONNECTED) { 
-      WiFiClient client = server.accept();
+    while (WiFi.status() == WL_CONNECTED && !m_stopRequested) { 
+      serviceConfig();
+      WiFiClient client;
+      {
+        TRACE_SCOPE("tcp.accept");
+        client = server.accept();
+      }
       if (!client) { delay(20); continue; }
       client.setNoDelay(true);
+      m_stats.connections++;
+      setLink(LinkState::CONNECTED, (uint32_t)client.remoteIP(), client.remotePort());
       
       Log.infoln("TcpServer(%s) accepted client from %s:%u", m_code.c_str(), client.remoteIP().toString().c_str(), client.remotePort());
+
+      // with RFC 2217 the client talks telnet and can reconfigure the port
+      Rfc2217Stream telnet(client, *this);
+      if (m_rfc2217) telnet.begin();
+      Stream& link = m_rfc2217 ? static_cast<Stream&>(telnet) : static_cast<Stream&>(client);
       
       // serve this single client until it disconnects
-      while (client.connected() && WiFi.status() == WL_CONNECTED) {
+      while (client.connected() && WiFi.status() == WL_CONNECTED && !m_stopRequested) {
+        serviceConfig();
         // TCP -> Serial
-        pumpStreamToStream(client, *m_stream, buffer, sizeof(buffer));
-        // Serial -> TCP
-        pumpStreamToStream(*m_stream, client, buffer, sizeof(buffer));
+        pumpStreamToStream(link, *m_stream, buffer, sizeof(buffer), Direction::LINK_TO_SERIAL);
+        // Serial -> TCP, held back while the client has suspended flow
+        if (!telnet.suspended()) pumpStreamToStream(*m_stream, link, buffer, sizeof(buffer), Direction::SERIAL_TO_LINK);
         
         // small delay to yield cpu
-        if (client.available() == 0 && m_stream->available() == 0) delay(2);
+        if (m_paused || m_sendHeld || (link.available() == 0 && m_stream->available() == 0)) delay(2);
       }
       
       Log.infoln("TcpServer(%s) client disconnected", m_code.c_str());
       
       client.stop();
+      setLink(LinkState::LISTENING);
       delay(10);
     }
   }
+
+  server.end();
+  setLink(LinkState::STOPPED);
+  Log.infoln("TcpServer(%s) stopped task", m_code.c_str());
+  m_running = false;
+  TRACE_TASK_EXIT();
+  vTaskDelete(nullptr);
 }
 
 void SerialBridge::tcpClientTask()
@@ -181,24 +649,32 @@ void SerialBridge::tcpClientTask()
   WiFiClient client;
   uint8_t buffer[512];
 
-  for (;;) {
+  while (!m_stopRequested) {
+    serviceConfig();
+
     // wait for WiFi
-    if (WiFi.status() != WL_CONNECTED) { delay(250); }
+    if (WiFi.status() != WL_CONNECTED) { setLink(LinkState::WAITING); delay(250); }
 
     // connect (with simple backoff)
     if (!client.connected()) {
       client.stop();
       client.setNoDelay(true);
-      if (client.connect(m_host.c_str(), m_port)) {
+      if (WiFi.status() == WL_CONNECTED) setLink(LinkState::CONNECTING);
+      TRACE_BEGIN("tcp.connect");
+      bool connected = client.connect(m_host.c_str(), m_port);
+      TRACE_END("tcp.connect");
+      if (connected) {
+        m_stats.connections++;
+        setLink(LinkState::CONNECTED, (uint32_t)client.remoteIP(), client.remotePort());
         Log.infoln("TcpClient(%s) connected to %s:%u", m_code.c_str(), m_host.c_str(), m_port);
       } else delay(2000);
       continue;
     }
 
     // TCP -> Serial
-    pumpStreamToStream(client, *m_stream, buffer, sizeof(buffer));
+    pumpStreamToStream(client, *m_stream, buffer, sizeof(buffer), Direction::LINK_TO_SERIAL);
     // Serial -> TCP
-    pumpStreamToStream(*m_stream, client, buffer, sizeof(buffer));
+    pumpStreamToStream(*m_stream, client, buffer, sizeof(buffer), Direction::SERIAL_TO_LINK);
 
     // if link dropped, loop will reconnect
     if (!client.connected() || WiFi.status() != WL_CONNECTED) {
@@ -209,8 +685,15 @@ void SerialBridge::tcpClientTask()
     }
 
     // small delay to yield cpu
-    if (client.available() == 0 && m_stream->available() == 0) delay(2);
+    if (m_paused || m_sendHeld || (client.available() == 0 && m_stream->available() == 0)) delay(2);
   }
+
+  client.stop();
+  setLink(LinkState::STOPPED);
+  Log.infoln("TcpClient(%s) stopped task", m_code.c_str());
+  m_running = false;
+  TRACE_TASK_EXIT();
+  vTaskDelete(nullptr);
 }
 
 void SerialBridge::bluetoothTask()
@@ -222,9 +705,14 @@ void SerialBridge::bluetoothTask()
   while (1);
 #endif
 
-  for (;;) {
+  while (!m_stopRequested) {
     delay(500);
   }
+
+  Log.infoln("Bluetooth(%s) stopped task", m_code.c_str());
+  m_running = false;
+  TRACE_TASK_EXIT();
+  vTaskDelete(nullptr);
 }
 
 void SerialBridge::bleTask()
@@ -245,28 +733,470 @@ void SerialBridge::bleTask()
 
   for (;;) {
     // wait for connection
+    setLink(LinkState::LISTENING);
     while (!bleSerial.isConnected()) { delay(500); }
+    m_stats.connections++;
+    setLink(LinkState::CONNECTED);
     Log.infoln("BLE(%s) connected to peer", m_code.c_str());
 
     while (bleSerial.isConnected()) {
+      serviceConfig();
       // BLE -> Serial
-      pumpStreamToStream(bleSerial, *m_stream, buffer, sizeof(buffer));
+      pumpStreamToStream(bleSerial, *m_stream, buffer, sizeof(buffer), Direction::LINK_TO_SERIAL);
       // Serial -> BLE
-      pumpStreamToStream(*m_stream, bleSerial, buffer, sizeof(buffer));
+      pumpStreamToStream(*m_stream, bleSerial, buffer, sizeof(buffer), Direction::SERIAL_TO_LINK);
+
+      if (m_paused || m_sendHeld) delay(2);
     }
 
     Log.infoln("BLE(%s) peer disconnected", m_code.c_str());
   }
 }
 
-void SerialBridge::pumpStreamToStream(Stream& in, Stream& out, uint8_t* buf, size_t cap) {
+void SerialBridge::serialPeerTask()
+{
+  Log.infoln("SerialPeer(%s) started task, cross-connecting to %s...", m_code.c_str(), m_peer->m_code.c_str());
+
+  // flush the rx fifo after one idle symbol instead of the default ten, kept across format changes
+  m_rxTimeout = 1;
+  m_peer->m_rxTimeout = 1;
+
+  // larger buffers absorb the backlog when both sides run at different baud rates
+  initStream(1024);
+  m_peer->initStream(1024);
+
+  Stream& peerStream = *m_peer->m_stream;
+  uint8_t buffer[256];
+  m_stats.connections++;
+  m_peer->m_stats.connections++;
+  setLink(LinkState::CONNECTED);
+  m_peer->setLink(LinkState::CONNECTED);
+
+  while (!m_stopRequested) {
+    serviceConfig();
+    m_peer->serviceConfig();
+
+    // either side may be running a self test
+    if (m_paused || m_peer->m_paused) { delay(2); continue; }
+
+    // Serial -> Peer, the pump accounts the peer's side too
+    pumpStreamToStream(*m_stream, peerStream, buffer, sizeof(buffer), Direction::SERIAL_TO_LINK);
+    // Peer -> Serial
+    pumpStreamToStream(peerStream, *m_stream, buffer, sizeof(buffer), Direction::LINK_TO_SERIAL);
+
+    // shortest possible yield, there is no network stack to wait on
+    if (peerStream.available() == 0 && m_stream->available() == 0) delay(1);
+  }
+
+  Log.infoln("SerialPeer(%s) stopped task", m_code.c_str());
+  setLink(LinkState::STOPPED);
+  m_peer->setLink(LinkState::STOPPED);
+  m_crossConnected = false;
+  m_rxTimeout = 0;
+  m_peer->m_rxTimeout = 0;
+  m_running = false;
+  TRACE_TASK_EXIT();
+  vTaskDelete(nullptr);
+}
+
+size_t SerialBridge::pumpStreamToStream(Stream& in, Stream& out, uint8_t* buf, size_t cap, Direction dir) {
+  size_t total = 0;
+  if (m_paused) return 0;
+
+  // expanding transforms read into the tail of the buffer and grow towards the front
+  const ByteTransform& xf = m_transforms[static_cast<uint8_t>(dir)];
+  size_t offset = xf.inputOffset(cap);
+  size_t inCap = xf.inputCap(cap);
+
+  // network sends go through the qos gate, a cross-connect never touches the network
+  bool send = dir == Direction::SERIAL_TO_LINK && m_bridgeType != BridgeType::SERIAL_PEER;
   int avail = in.available();
-  while (avail > 0) {
-    size_t n = ((size_t)avail > cap) ? cap : (size_t)avail;
-    int r = in.readBytes(buf, n);
-    if (r > 0) out.write(buf, (size_t)r);
+  size_t budget = send ? beginSend(avail > 0 ? (size_t)avail : 0) : SIZE_MAX;
+  while (avail > 0 && budget > 0) {
+    size_t n = ((size_t)avail > inCap) ? inCap : (size_t)avail;
+    if (n > budget) n = budget;
+    TRACE_BEGIN(dir == Direction::SERIAL_TO_LINK ? "serial.read" : "link.read");
+    int r = in.readBytes(buf + offset, n);
+    TRACE_END(dir == Direction::SERIAL_TO_LINK ? "serial.read" : "link.read");
+    if (r > 0) {
+      // stats and monitor see the serial side of the wire, a cross-connect has one at both ends
+      if (dir == Direction::SERIAL_TO_LINK) account(dir, buf + offset, (size_t)r);
+      else if (m_peer && &in == m_peer->m_stream) m_peer->account(Direction::SERIAL_TO_LINK, buf + offset, (size_t)r);
+      size_t len = xf.apply(buf, offset, (size_t)r);
+      TRACE_BEGIN(dir == Direction::SERIAL_TO_LINK ? "link.write" : "serial.write");
+      if (&out == m_stream) writeSerial(buf, len);
+      else if (m_peer && &out == m_peer->m_stream) m_peer->writeSerial(buf, len);
+      else out.write(buf, len);
+      TRACE_END(dir == Direction::SERIAL_TO_LINK ? "link.write" : "serial.write");
+      if (dir == Direction::LINK_TO_SERIAL) account(dir, buf, len);
+      else if (m_peer && &out == m_peer->m_stream) m_peer->account(Direction::LINK_TO_SERIAL, buf, len);
+      if (send) {
+        sent((size_t)r, len);
+        budget -= ((size_t)r < budget) ? (size_t)r : budget;
+      }
+      total += (size_t)r;
+    }
     avail = in.available();
   }
+
+  // the whole batch went out under a single DE assertion
+  if (&out == m_stream) endSerialWrite();
+  else if (m_peer && &out == m_peer->m_stream) m_peer->endSerialWrite();
+  return total;
+}
+
+void SerialBridge::writeSerial(const uint8_t* buf, size_t len)
+{
+  if (m_rs485 && m_dePin >= 0 && !m_rs485Driving) {
+    // rx -> tx turnaround, give the last talker 1.5 character times to release the bus
+    uint32_t guardUs = m_charTimeUs * 3 / 2;
+    uint32_t idleUs = micros() - m_lastRxUs;
+    if (idleUs < guardUs) {
+      m_stats.rs485GuardWaits++;
+      delayMicroseconds(guardUs - idleUs);
+    }
+
+    if (m_rxSinceTx) {
+      uint32_t turnaroundUs = micros() - m_lastRxUs;
+      if (turnaroundUs > m_stats.rs485MaxTurnaroundUs) m_stats.rs485MaxTurnaroundUs = turnaroundUs;
+      m_rxSinceTx = false;
+    }
+    m_stats.rs485Turnarounds++;
+
+    if (!m_rs485Hw) digitalWrite(m_dePin, HIGH);
+    m_rs485Driving = true;
+  }
+
+  m_stream->write(buf, len);
+}
+
+void SerialBridge::endSerialWrite()
+{
+  if (!m_rs485Driving) return;
+
+  // wait for the last stop bit to leave the shift register before letting go of the bus
+  m_stream->flush();
+  if (!m_rs485Hw) digitalWrite(m_dePin, LOW);
+  m_rs485Driving = false;
+
+  // only the uart can tell what was on the bus while we were driving it
+  bool collision = false;
+  if (m_rs485Hw && m_uartNum >= 0 && uart_get_collision_flag((uart_port_t)m_uartNum, &collision) == ESP_OK && collision) {
+    m_stats.rs485Collisions++;
+  }
+}
+
+size_t SerialBridge::beginSend(size_t pending)
+{
+  uint32_t now = micros();
+  m_queueDelay.observe(pending, now);
+  m_sendHeld = false;
+  if (pending == 0) {
+    m_deferring = false;
+    m_throttled = false;
+    return 0;
+  }
+
+  // bulk data steps aside while latency bridges are active, for kMaxDeferUs at most; after
+  // a full deferral it goes out undeferred for as long again, so a busy latency bridge gets
+  // at most half the time of a backlogged bulk one
+  if (m_deferSpent && now - m_deferSinceUs >= kMaxDeferUs) m_deferSpent = false;
+  if (m_qos == QosClass::BULK && !m_deferSpent && now - g_latencySentUs.load() < kLatencyHoldOffUs) {
+    if (!m_deferring) {
+      m_deferring = true;
+      m_deferSinceUs = now;
+      m_stats.sendsDeferred++;
+    }
+    if (now - m_deferSinceUs < kMaxDeferUs) {
+      m_sendHeld = true;
+      return 0;
+    }
+    m_deferSpent = true;
+    m_deferSinceUs = now;
+  }
+  m_deferring = false;
+
+  size_t budget = m_sendBucket.available(now);
+  if (budget == 0) {
+    if (!m_throttled) m_stats.sendsThrottled++;
+    m_throttled = true;
+    m_sendHeld = true;
+    return 0;
+  }
+  m_throttled = false;
+  return budget;
+}
+
+void SerialBridge::sent(size_t inputBytes, size_t wireBytes)
+{
+  uint32_t now = micros();
+  m_sendBucket.consume(wireBytes);
+  if (m_qos == QosClass::LATENCY && wireBytes) g_latencySentUs = now;
+
+  uint32_t delayUs = m_queueDelay.sent(inputBytes, now);
+  // 1/8 weight moving average
+  int32_t diff = (int32_t)delayUs - (int32_t)m_stats.queueDelayAvgUs;
+  m_stats.queueDelayAvgUs += diff / 8;
+  if (delayUs > m_stats.queueDelayMaxUs) m_stats.queueDelayMaxUs = delayUs;
+}
+
+void SerialBridge::account(Direction dir, const uint8_t* buf, size_t len)
+{
+  if (dir == Direction::SERIAL_TO_LINK) {
+    m_stats.serialRxBytes += len;
+    m_lastRxUs = micros();
+    m_rxSinceTx = true;
+  } else {
+    m_stats.serialTxBytes += len;
+  }
+  if (m_monitor) m_monitor(this, dir, buf, len, m_monitorArg);
+}
+
+bool SerialBridge::startSelfTest(SelfTestMode mode, uint32_t rate, uint32_t durationMs)
+{
+  if (m_selfTestRunning || m_autoBaudRunning) return false;
+  if (mode == SelfTestMode::TCP_LOOPBACK && m_bridgeType != BridgeType::TCP_SERVER) {
+    Log.warningln("SelfTest(%s) TCP loopback needs a TCP server bridge", m_code.c_str());
+    return false;
+  }
+  // the bridge serves one client, the test would take its place or be refused
+  if (mode == SelfTestMode::TCP_LOOPBACK && m_linkState != LinkState::LISTENING) {
+    Log.warningln("SelfTest(%s) TCP loopback needs the bridge listening with no client connected", m_code.c_str());
+    return false;
+  }
+
+  m_selfTestMode = mode;
+  m_selfTestRate = rate ? rate : m_baud / frameBits(m_fmt);
+  m_selfTestDurationMs = durationMs;
+  m_selfTestRunning = true;
+  xTaskCreate((TaskFunction_t)(&SerialBridge::selfTestTask), "SelfTest", 4096, this, 1, nullptr);
+  return true;
+}
+
+void SerialBridge::selfTestTask()
+{
+  runSelfTest();
+  m_selfTestRunning = false;
+  TRACE_TASK_EXIT();
+  vTaskDelete(nullptr);
+}
+
+void SerialBridge::runSelfTest()
+{
+  Log.infoln("SelfTest(%s) %s at %u B/s for %u ms...", m_code.c_str(), toCString(m_selfTestMode), m_selfTestRate, m_selfTestDurationMs);
+
+  // TCP loopback runs the whole path: local client -> bridge -> uart tx -> cable -> uart rx -> bridge -> client
+  WiFiClient client;
+  Stream* io = m_stream;
+  if (m_selfTestMode == SelfTestMode::TCP_LOOPBACK) {
+    if (!client.connect("127.0.0.1", m_port)) {
+      Log.errorln("SelfTest(%s) cannot connect to the bridge on port %u", m_code.c_str(), m_port);
+      return;
+    }
+    client.setNoDelay(true);
+    io = &client;
+  } else {
+    // take the port over, give the bridge task a moment to step away
+    m_paused = true;
+    delay(20);
+    purgeSerial(true, false);
+  }
+
+  PrbsTester* tester = new PrbsTester(m_selfTestRate);
+  uint8_t buffer[512];
+  tester->begin(micros());
+
+  uint32_t start = millis();
+  uint32_t drainUntil = 0;
+  for (;;) {
+    bool sending = millis() - start < m_selfTestDurationMs;
+    if (sending) {
+      size_t n = tester->generate(buffer, sizeof(buffer), micros());
+      if (n) io->write(buffer, n);
+    } else if (!drainUntil) {
+      // let data in flight come back before counting it lost
+      drainUntil = millis() + 250;
+    } else if ((int32_t)(millis() - drainUntil) >= 0) {
+      break;
+    }
+
+    int avail = io->available();
+    while (avail > 0) {
+      int r = io->readBytes(buffer, (size_t)avail > sizeof(buffer) ? sizeof(buffer) : (size_t)avail);
+      if (r > 0) tester->receive(buffer, (size_t)r, micros());
+      avail = io->available();
+    }
+    delay(1);
+  }
+
+  m_selfTestResults = tester->results(micros());
+  delete tester;
+
+  if (m_selfTestMode == SelfTestMode::TCP_LOOPBACK) {
+    client.stop();
+  } else {
+    purgeSerial(true, false);
+    m_paused = false;
+  }
+
+  // ArduinoLog has no exponent format
+  const SelfTestResults& res = m_selfTestResults;
+  char rates[48];
+  snprintf(rates, sizeof(rates), "BER %.2e, loss %.2e", res.bitErrorRate, res.byteLossRate);
+  Log.infoln("SelfTest(%s) %u B/s, %s, latency p50/p95/p99 %u/%u/%u us", m_code.c_str(),
+    res.throughputBps, rates, res.latencyP50Us, res.latencyP95Us, res.latencyP99Us);
+
+  m_selfTestGeneration++;
+}
+
+bool SerialBridge::startAutoBaud(bool persist, uint32_t timeoutMs)
+{
+  if (m_streamType != HW_SERIAL || m_selfTestRunning || m_autoBaudRunning) return false;
+
+  m_autoBaudPersist = persist;
+  m_autoBaudTimeoutMs = timeoutMs;
+  m_autoBaudRunning = true;
+  xTaskCreate((TaskFunction_t)(&SerialBridge::autoBaudTask), "AutoBaud", 3072, this, 1, nullptr);
+  return true;
+}
+
+// whether the masked bits of the sample have both even and odd parity
+static bool mixedParity(const uint8_t* buf, size_t len, uint8_t mask)
+{
+  bool seen[2] = { false, false };
+  for (size_t i = 0; i < len; ++i) seen[__builtin_popcount(buf[i] & mask) & 1] = true;
+  return seen[0] && seen[1];
+}
+
+uint32_t SerialBridge::sampleCandidate(unsigned long baud, SerialFormat fmt, uint8_t* buf, size_t cap, size_t* len)
+{
+  // candidates come from the sweep tables, switch quietly
+  configureUart(baud, fmt);
+
+  // the character in flight at the switch is garbage
+  delay(2);
+  purgeSerial(true, false);
+  m_frameErrors = 0;
+  m_parityErrors = 0;
+
+  *len = 0;
+  uint32_t start = millis();
+  while (*len < cap && millis() - start < kAutoBaudSampleMs) {
+    int avail = m_stream->available();
+    if (avail <= 0) { delay(1); continue; }
+    int r = m_stream->readBytes(buf + *len, min((size_t)avail, cap - *len));
+    if (r > 0) *len += (size_t)r;
+  }
+  return m_frameErrors + m_parityErrors;
+}
+
+void SerialBridge::autoBaudTask()
+{
+  Log.infoln("AutoBaud(%s) detecting, timeout %u ms...", m_code.c_str(), m_autoBaudTimeoutMs);
+
+  unsigned long origBaud = m_baud;
+  SerialFormat origFmt = m_fmt;
+  uint32_t start = millis();
+
+  // take the port over, give the bridge task a moment to step away
+  m_paused = true;
+  delay(20);
+
+  // 7 bit formats are read as 8N1 and told apart by their parity bit, 8N2 reads cleanly as 8N1
+  static constexpr SerialFormat kProbeFormats[] = { SerialFormat::F8N1, SerialFormat::F8E1, SerialFormat::F8O1 };
+
+  AutoBaudResult res = {};
+  uint8_t sample[kAutoBaudLockBytes];
+  uint32_t bestRatio = UINT32_MAX;
+  size_t bestLen = 0;
+  bool heard = false;
+
+  // the stored baud is the best guess, try it before the list
+  std::vector<unsigned long> rates{ origBaud };
+  for (unsigned long rate : kAutoBaudRates) if (rate != origBaud) rates.push_back(rate);
+
+  while (!res.locked && millis() - start < m_autoBaudTimeoutMs) {
+    // formats outside, between them a candidate only changes the baud rate
+    for (SerialFormat fmt : kProbeFormats) {
+      for (unsigned long rate : rates) {
+        size_t len;
+        uint32_t errors = sampleCandidate(rate, fmt, sample, sizeof(sample), &len);
+        res.candidates++;
+
+        // a silent line says nothing about this candidate
+        if (len == 0 && errors == 0) continue;
+        heard = true;
+
+        // a parity format only reads cleanly for a reason if the data had both parities,
+        // 'U' after 'U' passes as 8E1 whatever the line is
+        bool telling = fmt == SerialFormat::F8N1 || mixedParity(sample, len, 0xFF);
+
+        // error events per thousand characters, ties go to the candidate that decoded more
+        uint32_t ratio = errors * 1000 / (len + errors);
+        if (telling && len >= 8 && (ratio < bestRatio || (ratio == bestRatio && len > bestLen))) {
+          bestRatio = ratio;
+          bestLen = len;
+          res.baud = rate;
+          res.fmt = fmt;
+        }
+
+        if (telling && errors == 0 && len >= kAutoBaudLockBytes) {
+          res.locked = true;
+          res.baud = rate;
+          res.fmt = fmt;
+          // only data whose 7 bit parts differ in parity shows bit 7 tracking them
+          if (fmt == SerialFormat::F8N1 && mixedParity(sample, len, 0x7F)) {
+            // every byte with even (odd) overall parity means 7 data bits plus parity
+            size_t even = 0;
+            for (size_t i = 0; i < len; ++i) even += (__builtin_popcount(sample[i]) & 1) ? 0 : 1;
+            if (even == len) res.fmt = SerialFormat::F7E1;
+            else if (even == 0) res.fmt = SerialFormat::F7O1;
+          }
+          break;
+        }
+        if (millis() - start >= m_autoBaudTimeoutMs) break;
+      }
+      // nothing heard at any baud, the parity formats will not hear more
+      if (res.locked || !heard || millis() - start >= m_autoBaudTimeoutMs) break;
+    }
+
+    // a full sweep without a clean lock, settle for a near clean best match
+    if (!res.locked && heard && bestRatio <= 20) res.locked = true;
+    // nothing on the line yet, wait for traffic
+    if (!heard) delay(50);
+  }
+  res.lockMs = millis() - start;
+
+  if (res.locked) {
+    applySerialConfig(res.baud, res.fmt);
+    if (m_autoBaudPersist) {
+      Preferences prefs;
+      if (prefs.begin(m_code.c_str(), false)) {
+        prefs.putULong("baud", res.baud);
+        prefs.putUChar("fmt", static_cast<uint8_t>(res.fmt));
+        prefs.end();
+      } else {
+        Log.warningln("Unable to save %s Preferences", m_code.c_str());
+      }
+    }
+    Log.infoln("AutoBaud(%s) locked on %u %s in %u ms after %u candidates%s", m_code.c_str(), res.baud, toCString(res.fmt),
+      res.lockMs, res.candidates, m_autoBaudPersist ? ", saved" : "");
+  } else {
+    res.baud = origBaud;
+    res.fmt = origFmt;
+    applySerialConfig(origBaud, origFmt);
+    Log.warningln("AutoBaud(%s) no lock after %u ms (%s), keeping %u %s", m_code.c_str(), res.lockMs,
+      heard ? "no clean candidate" : "no traffic", origBaud, toCString(origFmt));
+  }
+
+  purgeSerial(true, false);
+  m_paused = false;
+
+  m_autoBaudResult = res;
+  m_autoBaudGeneration++;
+  m_autoBaudRunning = false;
+  TRACE_TASK_EXIT();
+  vTaskDelete(nullptr);
 }
 
 void initBle(String name)
@@ -3,6 +3,9 @@
 #include <HardwareSerial.h>
 #include <Preferences.h>
 #include "utils.h"
+#include "SelfTest.h"
+#include "ByteTransform.h"
+#include "Qos.h"
 
 #if defined(CONFIG_IDF_TARGET_ESP32)
   #define HAS_BLUETOOTH   1
@@ -17,9 +20,18 @@
 
 class SerialBridge {
   public:
-    SerialBridge(String name, String code, HardwareSerial& hwSerial);
+    SerialBridge(String name, String code, HardwareSerial& hwSerial, int8_t uartNum = -1);
     SerialBridge(String name, String code, HWCDC& hwCdc);
 
+    // baud rates outside this range are rejected
+    static constexpr unsigned long kMinBaud = 50;
+    static constexpr unsigned long kMaxBaud = 5000000;
+    // send rate limits outside this range are rejected, 0 turns the limit off
+    static constexpr uint32_t kMinRateLimit = 64;
+    static constexpr uint32_t kMaxRateLimit = kMaxBaud / 10;
+    // longest tcp client host name, as in DNS
+    static constexpr size_t kMaxHostLength = 253;
+
     enum class SerialFormat : uint8_t {
       F5N1, F6N1, F7N1, F8N1,
       F5N2, F6N2, F7N2, F8N2,
@@ -35,11 +47,98 @@ class SerialBridge {
       TCP_CLIENT,
       BLUETOOTH,
       BLE,
+      SERIAL_PEER,
+      MUX,
+      COUNT
+    };
+
+    enum class Direction : uint8_t {
+      SERIAL_TO_LINK,
+      LINK_TO_SERIAL
+    };
+
+    enum class SelfTestMode : uint8_t {
+      UART_LOOPBACK,
+      TCP_LOOPBACK,
+      COUNT
+    };
+
+    // latency bridges run at a higher priority and make bulk bridges hold back their network sends
+    enum class QosClass : uint8_t {
+      LATENCY,
+      BULK,
+      COUNT
+    };
+
+    enum class LinkState : uint8_t {
+      STOPPED,
+      WAITING,      // for WiFi
+      LISTENING,    // server up, or advertising, no client yet
+      CONNECTING,
+      CONNECTED,
       COUNT
     };
 
+    // byte counters, written only by the bridge task
+    struct Stats {
+      uint32_t serialRxBytes;
+      uint32_t serialTxBytes;
+      uint32_t connections;
+      uint32_t rs485Turnarounds;      // rx -> tx direction switches
+      uint32_t rs485GuardWaits;       // tx held back to honor the turnaround delay
+      uint32_t rs485Collisions;       // bus activity seen while we were driving it
+      uint32_t rs485MaxTurnaroundUs;  // longest rx -> tx switch, measured from the last rx byte
+      uint32_t queueDelayAvgUs;       // serial rx to network send, moving average
+      uint32_t queueDelayMaxUs;
+      uint32_t sendsDeferred;         // bulk sends held back for a latency bridge
+      uint32_t sendsThrottled;        // sends held back by the rate limit
+      uint32_t serialOverruns;        // uart rx buffer or fifo overflows, received data was lost
+    };
+
+    struct AutoBaudResult {
+      bool locked;
+      unsigned long baud;
+      SerialFormat fmt;
+      uint32_t lockMs;       // time from start to lock, or to giving up
+      uint16_t candidates;   // baud/format combinations sampled
+    };
+
+    // called from the bridge task for every chunk moved, keep it short
+    typedef void (*MonitorCallback)(SerialBridge* bridge, Direction dir, const uint8_t* data, size_t len, void* arg);
+
     void start();
-    void setConfig(BridgeType bType, String host, ushort port, unsigned long baud, SerialFormat fmt, bool hasEcho, bool simulateEcho);
+    // ends the bridge task, false if it cannot be stopped (BLE) or did not stop in time
+    bool stop();
+    void setPeer(SerialBridge* peer) { m_peer = peer; }
+    void setMonitor(MonitorCallback cb, void* arg) { m_monitorArg = arg; m_monitor = cb; }
+    // nothing is saved or applied when a value is out of range, error says which
+    bool setConfig(BridgeType bType, String host, ushort port, unsigned long baud, SerialFormat fmt, bool hasEcho, bool simulateEcho, bool rfc2217, String* error = nullptr);
+
+    // reconfigure the serial port without restarting, only call from the bridge task
+    void applySerialConfig(unsigned long baud, SerialFormat fmt);
+    bool setHwFlowControl(bool enable);
+    void purgeSerial(bool rx, bool tx);
+    void setRs485Config(bool enable, int8_t dePin);
+    // -1 for none, or a gpio that can drive an output
+    static bool isValidDePin(long pin);
+    // false for the "(N/A)" types this target has no radio stack for
+    static bool isSupported(BridgeType type);
+    // ByteTransform::Flag masks, applied live
+    void setTransforms(uint8_t serialToLink, uint8_t linkToSerial);
+    // rate limit in bytes per second on network sends, 0 for none, applied live
+    void setQos(QosClass qos, uint32_t rateLimit);
+
+    // rate in bytes per second, 0 runs at line rate
+    bool startSelfTest(SelfTestMode mode, uint32_t rate, uint32_t durationMs);
+    bool selfTestRunning() { return m_selfTestRunning; }
+    uint32_t selfTestGeneration() { return m_selfTestGeneration; }
+    SelfTestResults selfTestResults() { return m_selfTestResults; }
+
+    // find baud and format from live rx traffic, the network session stays up meanwhile
+    bool startAutoBaud(bool persist, uint32_t timeoutMs);
+    bool autoBaudRunning() { return m_autoBaudRunning; }
+    uint32_t autoBaudGeneration() { return m_autoBaudGeneration; }
+    AutoBaudResult autoBaudResult() { return m_autoBaudResult; }
 
     String name() { return m_name; }
     String code() { return m_code; }
@@ -50,6 +149,22 @@ class SerialBridge {
     SerialFormat format() { return m_fmt; }
     bool hasEcho() { return m_hasEcho; }
     bool simulateEcho() { return m_simulateEcho; }
+    bool rfc2217() { return m_rfc2217; }
+    bool hwFlowControl() { return m_hwFlowControl; }
+    bool isUart() { return m_streamType == HW_SERIAL; }
+    bool rs485() { return m_rs485; }
+    int8_t rs485DePin() { return m_dePin; }
+    uint8_t transforms(Direction dir) { return m_transforms[static_cast<uint8_t>(dir)].flags(); }
+    QosClass qos() { return m_qos; }
+    uint32_t rateLimit() { return m_rateLimit; }
+    SerialBridge* peer() { return m_peer; }
+    LinkState linkState() { return m_linkState; }
+    // who is on the other end while connected, "ip:port" or the cross-connected bridge, empty otherwise
+    String remoteAddress();
+    bool paused() { return m_paused; }
+    const Stats& stats() { return m_stats; }
+    // bumped by every setter, lets the ui notice changes made elsewhere
+    uint32_t configGeneration() { return m_configGeneration; }
 
     static inline String toString(SerialFormat fmt) { return enumToString(fmt, kFormatStr); }
     static inline const char* toCString(SerialFormat fmt) { return enumToCString(fmt, kFormatStr); }
@@ -59,6 +174,31 @@ class SerialBridge {
     static inline const char* toCString(BridgeType type) { return enumToCString(type, kTypeStr); }
     static inline BridgeType fromTypeString(const String& s) { return stringToEnum(s, kTypeStr, BridgeType::TCP_SERVER); }
 
+    static inline String toString(QosClass qos) { return enumToString(qos, kQosStr); }
+    static inline const char* toCString(QosClass qos) { return enumToCString(qos, kQosStr); }
+    static inline QosClass fromQosString(const String& s) { return stringToEnum(s, kQosStr, QosClass::BULK); }
+
+    // task priority for a class, latency stays below the network stack and the web server
+    static inline UBaseType_t taskPriority(QosClass qos) { return qos == QosClass::LATENCY ? 2 : 1; }
+
+    static inline String toString(LinkState state) { return enumToString(state, kLinkStateStr); }
+    static inline const char* toCString(LinkState state) { return enumToCString(state, kLinkStateStr); }
+
+    static inline String toString(SelfTestMode mode) { return enumToString(mode, kSelfTestModeStr); }
+    static inline const char* toCString(SelfTestMode mode) { return enumToCString(mode, kSelfTestModeStr); }
+    static inline SelfTestMode fromSelfTestModeString(const String& s) { return stringToEnum(s, kSelfTestModeStr, SelfTestMode::UART_LOOPBACK); }
+
+    // format fields, parity is one of 'N', 'E', 'O'
+    static inline uint8_t dataBits(SerialFormat fmt) { return enumToCString(fmt, kFormatStr)[0] - '0'; }
+    static inline char parity(SerialFormat fmt) { return enumToCString(fmt, kFormatStr)[1]; }
+    static inline uint8_t stopBits(SerialFormat fmt) { return enumToCString(fmt, kFormatStr)[2] - '0'; }
+    static inline uint8_t frameBits(SerialFormat fmt) { return 1 + dataBits(fmt) + (parity(fmt) != 'N' ? 1 : 0) + stopBits(fmt); }
+    static inline SerialFormat makeFormat(uint8_t dataBits, char parity, uint8_t stopBits) {
+      // formats are laid out as 4 data sizes per (parity, stop bits) group
+      uint8_t p = (parity == 'E') ? 1 : (parity == 'O') ? 2 : 0;
+      return static_cast<SerialFormat>((constrain(dataBits, 5, 8) - 5) + 4 * (p * 2 + (stopBits == 2 ? 1 : 0)));
+    }
+
   private:
 
     enum SerialType {
@@ -86,13 +226,36 @@ class SerialBridge {
       "Bluetooth (N/A)",
       #endif
       #if HAS_BLE
-      "BLE"
+      "BLE",
       #else
-      "BLE (N/A)"
+      "BLE (N/A)",
       #endif
+      "Serial Cross-Connect",
+      "Multiplexed"
     };
     static_assert(static_cast<size_t>(SerialBridge::BridgeType::COUNT) == sizeof(kTypeStr)/sizeof(kTypeStr[0]), "mismatch");
 
+    static constexpr const char* kSelfTestModeStr[] = {
+      "UART Loopback",
+      "TCP Loopback"
+    };
+    static_assert(static_cast<size_t>(SerialBridge::SelfTestMode::COUNT) == sizeof(kSelfTestModeStr)/sizeof(kSelfTestModeStr[0]), "mismatch");
+
+    static constexpr const char* kQosStr[] = {
+      "Latency",
+      "Bulk"
+    };
+    static_assert(static_cast<size_t>(SerialBridge::QosClass::COUNT) == sizeof(kQosStr)/sizeof(kQosStr[0]), "mismatch");
+
+    static constexpr const char* kLinkStateStr[] = {
+      "Stopped",
+      "Waiting for WiFi",
+      "Listening",
+      "Connecting",
+      "Connected"
+    };
+    static_assert(static_cast<size_t>(SerialBridge::LinkState::COUNT) == sizeof(kLinkStateStr)/sizeof(kLinkStateStr[0]), "mismatch");
+
     static inline uint32_t toArduinoConfig(SerialFormat f) {
       switch (f) {
         case SerialFormat::F5N1: return SERIAL_5N1;
@@ -132,17 +295,127 @@ class SerialBridge {
     SerialFormat m_fmt;
     bool m_hasEcho;
     bool m_simulateEcho;
+    bool m_rfc2217;
+    bool m_hwFlowControl = false;
+
+    // serial settings saved while the task runs, applied by the task itself
+    volatile bool m_serialDirty = false;
+    unsigned long m_pendingBaud;
+    SerialFormat m_pendingFmt;
 
     SerialType m_streamType;
     Stream* m_stream;
+    int8_t m_uartNum = -1;
+    size_t m_rxBufferSize = 0;   // last one given to the uart, 0 for the core's default
+
+    // rs485 half duplex, DE/RE driven by the uart when it can, by us otherwise
+    bool m_rs485 = false;
+    int8_t m_dePin = -1;
+    bool m_rs485Hw = false;
+    bool m_rs485Driving = false;
+    uint32_t m_charTimeUs = 0;
+    uint32_t m_lastRxUs = 0;
+    bool m_rxSinceTx = false;
+    volatile bool m_rs485Dirty = false;
+    bool m_pendingRs485;
+    int8_t m_pendingDePin;
+
+    // per direction, indexed by Direction
+    ByteTransform m_transforms[2];
+    volatile bool m_transformsDirty = false;
+    uint8_t m_pendingTransforms[2];
+
+    // network send scheduling, the bucket and delay tracking belong to the sending task
+    QosClass m_qos = QosClass::BULK;
+    uint32_t m_rateLimit = 0;
+    volatile bool m_qosDirty = false;
+    TokenBucket m_sendBucket;
+    QueueDelay m_queueDelay;
+    bool m_deferring = false;
+    bool m_deferSpent = false;       // a deferral ran its full length, bulk goes first for as long
+    bool m_throttled = false;
+    uint32_t m_deferSinceUs = 0;
+    // set when the last send was held back with data waiting, the task should yield
+    bool m_sendHeld = false;
+
+    SerialBridge* m_peer = nullptr;
+    bool m_configLoaded = false;
+    bool m_crossConnected = false;
+    // uart rx timeout in symbols, re-applied after every begin(); 0 keeps the core's default
+    uint8_t m_rxTimeout = 0;
+    volatile uint32_t m_configGeneration = 0;
+
+    // task lifecycle, the task clears m_running right before deleting itself
+    TaskHandle_t m_task = nullptr;
+    volatile bool m_running = false;
+    volatile bool m_stopRequested = false;
+
+    // bridge settings waiting for the restart task, guarded by g_restartMutex
+    bool m_restarting = false;
+    bool m_restartPending = false;
+    BridgeType m_pendingType;
+    String m_pendingHost;
+    ushort m_pendingPort;
+    bool m_pendingRfc2217;
+
+    // link state for the ui, written by whichever task serves the bridge
+    volatile LinkState m_linkState = LinkState::STOPPED;
+    volatile uint32_t m_remoteIp = 0;
+    volatile uint16_t m_remotePort = 0;
+
+    // set while something else owns the serial port, the bridge keeps its session but moves no data
+    volatile bool m_paused = false;
+
+    volatile bool m_selfTestRunning = false;
+    volatile uint32_t m_selfTestGeneration = 0;
+    SelfTestMode m_selfTestMode;
+    uint32_t m_selfTestRate;
+    uint32_t m_selfTestDurationMs;
+    SelfTestResults m_selfTestResults = {};
+
+    volatile bool m_autoBaudRunning = false;
+    volatile uint32_t m_autoBaudGeneration = 0;
+    bool m_autoBaudPersist;
+    uint32_t m_autoBaudTimeoutMs;
+    AutoBaudResult m_autoBaudResult = {};
+    // uart error events while sampling a candidate, counted from the uart event task
+    volatile uint32_t m_frameErrors = 0;
+    volatile uint32_t m_parityErrors = 0;
+
+    Stats m_stats = {};
+    MonitorCallback m_monitor = nullptr;
+    void* m_monitorArg = nullptr;
 
     void tcpServerTask();
     void tcpClientTask();
     void bluetoothTask();
     void bleTask();
+    void serialPeerTask();
+    void selfTestTask();
+    void runSelfTest();
+    void restartTask();
+    void autoBaudTask();
+    uint32_t sampleCandidate(unsigned long baud, SerialFormat fmt, uint8_t* buf, size_t cap, size_t* len);
 
-    void pumpStreamToStream(Stream& in, Stream& out, uint8_t* buf, size_t cap);
+    size_t pumpStreamToStream(Stream& in, Stream& out, uint8_t* buf, size_t cap, Direction dir);
+    void account(Direction dir, const uint8_t* buf, size_t len);
+    // serial -> link gate, returns how many input bytes may go out now
+    size_t beginSend(size_t pending);
+    void sent(size_t inputBytes, size_t wireBytes);
+    void writeSerial(const uint8_t* buf, size_t len);
+    void endSerialWrite();
+    void applyRs485();
+    // no checks and no logging, the auto baud sweep probes through this directly
+    void configureUart(unsigned long baud, SerialFormat fmt);
 
+    void serviceConfig();
+    void setLink(LinkState state, uint32_t remoteIp = 0, uint16_t remotePort = 0);
+    void applyBridgeConfig(BridgeType bType, String host, ushort port, bool rfc2217);
+    void takePendingSerialConfig();
     bool loadConfig();
-    bool initStream();
+    // bufferSize 0 sizes the rx buffer for the line rate, see rxBufferSize()
+    bool initStream(size_t bufferSize = 0);
+    size_t rxBufferSize();
+
+    friend class MuxServer;
 };
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "Trace.h"
+
+#if TRACE_ENABLED
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <memory>
+#include <vector>
+
+static constexpr uint8_t kMaxRings = 8;
+static constexpr uint32_t kRingSize = 128;  // power of two
+static_assert((kRingSize & (kRingSize - 1)) == 0, "ring size must be a power of two");
+
+// 64 bit microseconds, a rarely written ring may hold events from minutes ago
+struct TraceEvent {
+  int64_t timeUs;
+  const char* name;
+  char phase;
+};
+
+// written only by its own task, the dump reads it unlocked; the task name is
+// copied at claim time, the handle is only compared, never passed to FreeRTOS
+struct TraceRing {
+  TaskHandle_t task;   // nullptr once the task exited, the ring can be reclaimed
+  char taskName[configMAX_TASK_NAME_LEN];
+  uint32_t head;
+  TraceEvent events[kRingSize];
+};
+
+static TraceRing g_rings[kMaxRings];
+static volatile uint8_t g_ringCount = 0;   // rings ever claimed
+static volatile uint32_t g_droppedEvents = 0;
+static portMUX_TYPE g_ringLock = portMUX_INITIALIZER_UNLOCKED;
+
+static TraceRing* traceRing()
+{
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  uint8_t count = g_ringCount;
+  for (uint8_t i = 0; i < count; ++i) {
+    if (g_rings[i].task == self) return &g_rings[i];
+  }
+
+  // first event from this task, claim an unused ring or one whose task exited
+  TraceRing* ring = nullptr;
+  portENTER_CRITICAL(&g_ringLock);
+  if (g_ringCount < kMaxRings) {
+    ring = &g_rings[g_ringCount];
+    g_ringCount = g_ringCount + 1;
+  } else {
+    for (uint8_t i = 0; i < kMaxRings && !ring; ++i) {
+      if (!g_rings[i].task) ring = &g_rings[i];
+    }
+  }
+  if (ring) {
+    ring->task = self;
+    ring->head = 0;
+  }
+  portEXIT_CRITICAL(&g_ringLock);
+
+  // our own name, safe to read while we run
+  if (ring) strlcpy(ring->taskName, pcTaskGetName(nullptr), sizeof(ring->taskName));
+  return ring;
+}
+
+static inline void traceRecord(const char* name, char phase)
+{
+  int64_t timeUs = esp_timer_get_time();
+  TraceRing* ring = traceRing();
+  if (!ring) { g_droppedEvents = g_droppedEvents + 1; return; }
+  TraceEvent& ev = ring->events[ring->head & (kRingSize - 1)];
+  ev.timeUs = timeUs;
+  ev.name = name;
+  ev.phase = phase;
+  ring->head++;
+}
+
+void traceBegin(const char* name) { traceRecord(name, 'B'); }
+void traceEnd(const char* name) { traceRecord(name, 'E'); }
+
+void traceTaskExit()
+{
+  // the events stay for the next dump until another task takes the ring over
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  portENTER_CRITICAL(&g_ringLock);
+  for (uint8_t i = 0; i < g_ringCount; ++i) {
+    if (g_rings[i].task == self) g_rings[i].task = nullptr;
+  }
+  portEXIT_CRITICAL(&g_ringLock);
+}
+
+// snapshot of all rings, streamed out in chunks
+struct TraceDump {
+  struct Entry {
+    int64_t timeUs;
+    const char* name;
+    char phase;
+    uint8_t tid;
+  };
+
+  std::vector<Entry> entries;
+  char taskNames[kMaxRings][configMAX_TASK_NAME_LEN];
+  uint8_t rings;
+  uint32_t droppedEvents;
+  size_t next = 0;
+  bool headerSent = false;
+  uint8_t namesSent = 0;
+  bool footerSent = false;
+};
+
+static std::shared_ptr<TraceDump> traceSnapshot()
+{
+  auto dump = std::make_shared<TraceDump>();
+  dump->rings = g_ringCount;
+  dump->droppedEvents = g_droppedEvents;
+  dump->entries.reserve(dump->rings * kRingSize);
+
+  for (uint8_t r = 0; r < dump->rings; ++r) {
+    TraceRing& ring = g_rings[r];
+    memcpy(dump->taskNames[r], ring.taskName, sizeof(ring.taskName));
+    dump->taskNames[r][sizeof(ring.taskName) - 1] = 0;
+    uint32_t head = ring.head;
+    uint32_t count = head < kRingSize ? head : kRingSize;
+    for (uint32_t i = head - count; i != head; ++i) {
+      const TraceEvent& ev = ring.events[i & (kRingSize - 1)];
+      dump->entries.push_back({ ev.timeUs, ev.name, ev.phase, r });
+    }
+  }
+  return dump;
+}
+
+static size_t traceFill(TraceDump& dump, uint8_t* buffer, size_t maxLen)
+{
+  size_t len = 0;
+  char line[160];
+
+  auto put = [&](int n) {
+    if (n <= 0 || len + (size_t)n > maxLen) return false;
+    memcpy(buffer + len, line, n);
+    len += n;
+    return true;
+  };
+
+  if (!dump.headerSent) {
+    // events from tasks that found no free ring are only counted
+    if (!put(snprintf(line, sizeof(line), "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%u},\"traceEvents\":[",
+      (unsigned)dump.droppedEvents))) return len;
+    dump.headerSent = true;
+  }
+
+  // thread names first so viewers label the rows, a full chunk resumes where it stopped
+  while (dump.namesSent < dump.rings) {
+    uint8_t r = dump.namesSent;
+    int n = snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+      r ? "," : "", r, dump.taskNames[r]);
+    if (!put(n)) return len;
+    dump.namesSent++;
+  }
+
+  while (dump.next < dump.entries.size()) {
+    const TraceDump::Entry& e = dump.entries[dump.next];
+    int n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%lld}",
+      (dump.rings || dump.next) ? "," : "", e.name, e.phase, e.tid, e.timeUs);
+    if (!put(n)) return len;
+    dump.next++;
+  }
+
+  if (!dump.footerSent && put(snprintf(line, sizeof(line), "]}"))) dump.footerSent = true;
+  return len;
+}
+
+void traceRegister(AsyncWebServer* server)
+{
+  server->on("/trace", HTTP_GET, [](AsyncWebServerRequest* req) {
+      auto dump = traceSnapshot();
+      req->send(req->beginChunkedResponse("application/json", [dump](uint8_t* buffer, size_t maxLen, size_t) -> size_t {
+          return traceFill(*dump, buffer, maxLen);
+        }
+      ));
+    }
+  );
+}
+
+#endif
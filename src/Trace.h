@@ -0,0 +1,50 @@
+#pragma once
+
+// Hot path tracer, enable with -DTRACE_ENABLED=1. Every task records begin/end
+// events with microsecond timestamps into its own fixed size ring, /trace
+// dumps the rings as Chrome trace_event JSON (load it in chrome://tracing or
+// ui.perfetto.dev). Disabled builds compile every macro to nothing.
+//
+// Tasks that delete themselves call TRACE_TASK_EXIT() first so their ring can
+// go to the next new task.
+
+#ifndef TRACE_ENABLED
+  #define TRACE_ENABLED 0
+#endif
+
+#if TRACE_ENABLED
+
+class AsyncWebServer;
+
+void traceBegin(const char* name);
+void traceEnd(const char* name);
+void traceTaskExit();
+void traceRegister(AsyncWebServer* server);
+
+class TraceScope {
+  public:
+    explicit TraceScope(const char* name) : m_name(name) { traceBegin(name); }
+    ~TraceScope() { traceEnd(m_name); }
+  private:
+    const char* m_name;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// names must be string literals, only the pointer is stored
+#define TRACE_BEGIN(name) traceBegin(name)
+#define TRACE_END(name) traceEnd(name)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(_traceScope, __LINE__)(name)
+#define TRACE_TASK_EXIT() traceTaskExit()
+#define TRACE_REGISTER(server) traceRegister(server)
+
+#else
+
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_TASK_EXIT() do {} while (0)
+#define TRACE_REGISTER(server) do {} while (0)
+
+#endif
@@ -1,10 +1,15 @@
 #include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ArduinoLog.h>
 #include <ESPUI.h>
 #include <freertos/FreeRTOS.h>
 
+#include "ConfigApi.h"
+#include "FlashLog.h"
 #include "SerialBridge.h"
 #include "UserInterface.h"
 #include "WifiManager.h"
+#include "Trace.h"
 #include "utils.h"
 
 const char* g_logHtml = R"HTML(
@@ -65,12 +70,26 @@ document.addEventListener('DOMContentLoaded', () => {
 </script>
 )HTML";
 
+// transform selects, one per ByteTransform::Flag bit
+static constexpr const char* kTransformLabels[] = { "7-bit Mask", "Strip Non-Printables", "CRLF to LF", "LF to CRLF", "DLE Escape" };
+// option index bit 0 is serial -> network, bit 1 network -> serial
+static constexpr const char* kTransformDirections[] = { "Off", "Serial to Network", "Network to Serial", "Both" };
+
 // friend functions (ui callbacks)
 void tcpTypeChangedCallback(Control *sender, int type, void* arg);
+static void updateTypeVisibility(UserInterface::BridgeSettings* bridgeSettings, SerialBridge::BridgeType bType);
 void submittedBridgeDetailsCallback(Control *sender, int type, void* arg);
 void restartCallback(Control *sender, int type, void* arg);
 void submittedWifiDetailsCallback(Control *sender, int type, void* arg);
+void networkSelectedCallback(Control *sender, int type, void* arg);
+void scanCallback(Control *sender, int type, void* arg);
+void selfTestCallback(Control *sender, int type, void* arg);
+void autoBaudCallback(Control *sender, int type, void* arg);
 void nullCallback(Control *sender, int type, void* arg);
+void monitorCallback(SerialBridge* bridge, SerialBridge::Direction dir, const uint8_t* data, size_t len, void* arg);
+
+// bytes shown per chunk on the traffic monitor
+static constexpr size_t kMonitorBytes = 32;
 
 // This is the main function which builds our GUI
 void UserInterface::start() 
@@ -79,7 +98,7 @@ void UserInterface::start()
 	addWifiSettingsTab();
 	addLogsTab();
 	ESPUI.begin("Serial Bridge");
-	xTaskCreate((TaskFunction_t)(&UserInterface::task), "UserInterface", 2048, this, 1, nullptr);
+	xTaskCreate((TaskFunction_t)(&UserInterface::task), "UserInterface", 3072, this, 1, nullptr);
 }
 
 void UserInterface::task() 
@@ -94,6 +113,8 @@ void UserInterface::task()
 
 	// register log websocket
 	server->addHandler(&m_logWs);
+	// traffic monitor, fed by every bridge
+	server->addHandler(&m_monitorWs);
 
 	// html page
 	server->on("/logs", HTTP_GET, [](AsyncWebServerRequest* req) {
@@ -102,8 +123,124 @@ void UserInterface::task()
 		}
 	);
 
+	// persisted log lines for the log page, an empty list without FLASH_LOG
+	flashLogRegister(server);
+
+	// cached wifi scan results, strongest first
+	server->on("/wifi/networks", HTTP_GET, [](AsyncWebServerRequest* req) {
+			JsonDocument doc;
+			JsonArray arr = doc.to<JsonArray>();
+			for (const WifiNetwork& net : wifiGetAvailableNetworks()) {
+				JsonObject obj = arr.add<JsonObject>();
+				obj["ssid"] = net.ssid;
+				obj["rssi"] = net.rssi;
+				obj["channel"] = net.channel;
+				obj["open"] = net.open;
+			}
+			AsyncResponseStream* resp = req->beginResponseStream("application/json");
+			serializeJson(doc, *resp);
+			req->send(resp);
+		}
+	);
+	
+	// request a rescan, rate limited by the wifi manager
+	server->on("/wifi/scan", HTTP_POST, [](AsyncWebServerRequest* req) {
+			req->send(wifiStartScan() ? 202 : 429);
+		}
+	);
+
+	// last self test of a bridge
+	server->on("/selftest", HTTP_GET, [this](AsyncWebServerRequest* req) {
+			auto it = req->hasParam("bridge") ? m_bridges.find(req->getParam("bridge")->value()) : m_bridges.end();
+			if (it == m_bridges.end()) { req->send(404); return; }
+			SerialBridge* bridge = it->second.bridge;
+			SelfTestResults res = bridge->selfTestResults();
+			JsonDocument doc;
+			doc["running"] = bridge->selfTestRunning();
+			doc["generation"] = bridge->selfTestGeneration();
+			doc["elapsedMs"] = res.elapsedMs;
+			doc["bytesSent"] = res.bytesSent;
+			doc["bytesVerified"] = res.bytesVerified;
+			doc["bytesLost"] = res.bytesLost;
+			doc["framesOk"] = res.framesOk;
+			doc["framesBad"] = res.framesBad;
+			doc["syncSlips"] = res.syncSlips;
+			doc["bitErrors"] = res.bitErrors;
+			doc["throughputBps"] = res.throughputBps;
+			doc["bitErrorRate"] = res.bitErrorRate;
+			doc["byteLossRate"] = res.byteLossRate;
+			doc["latencyP50Us"] = res.latencyP50Us;
+			doc["latencyP95Us"] = res.latencyP95Us;
+			doc["latencyP99Us"] = res.latencyP99Us;
+			doc["latencyMaxUs"] = res.latencyMaxUs;
+			AsyncResponseStream* resp = req->beginResponseStream("application/json");
+			serializeJson(doc, *resp);
+			req->send(resp);
+		}
+	);
+
+	// start a self test, mode "uart" or "tcp", rate 0 runs at line rate
+	server->on("/selftest", HTTP_POST, [this](AsyncWebServerRequest* req) {
+			auto it = req->hasParam("bridge") ? m_bridges.find(req->getParam("bridge")->value()) : m_bridges.end();
+			if (it == m_bridges.end()) { req->send(404); return; }
+			SerialBridge::SelfTestMode mode = SerialBridge::SelfTestMode::UART_LOOPBACK;
+			if (req->hasParam("mode") && req->getParam("mode")->value() == "tcp") mode = SerialBridge::SelfTestMode::TCP_LOOPBACK;
+			uint32_t rate = req->hasParam("rate") ? toULong(req->getParam("rate")->value()) : 0;
+			uint32_t duration = req->hasParam("duration") ? toULong(req->getParam("duration")->value()) : 5000;
+			req->send(it->second.bridge->startSelfTest(mode, rate, duration) ? 202 : 409);
+		}
+	);
+
+	// last baud/format detection of a bridge
+	server->on("/autobaud", HTTP_GET, [this](AsyncWebServerRequest* req) {
+			auto it = req->hasParam("bridge") ? m_bridges.find(req->getParam("bridge")->value()) : m_bridges.end();
+			if (it == m_bridges.end()) { req->send(404); return; }
+			SerialBridge* bridge = it->second.bridge;
+			SerialBridge::AutoBaudResult res = bridge->autoBaudResult();
+			JsonDocument doc;
+			doc["running"] = bridge->autoBaudRunning();
+			doc["generation"] = bridge->autoBaudGeneration();
+			doc["locked"] = res.locked;
+			doc["baud"] = res.baud;
+			doc["format"] = SerialBridge::toCString(res.fmt);
+			doc["lockMs"] = res.lockMs;
+			doc["candidates"] = res.candidates;
+			AsyncResponseStream* resp = req->beginResponseStream("application/json");
+			serializeJson(doc, *resp);
+			req->send(resp);
+		}
+	);
+
+	// start a detection, persist=1 saves the result
+	server->on("/autobaud", HTTP_POST, [this](AsyncWebServerRequest* req) {
+			auto it = req->hasParam("bridge") ? m_bridges.find(req->getParam("bridge")->value()) : m_bridges.end();
+			if (it == m_bridges.end()) { req->send(404); return; }
+			bool persist = req->hasParam("persist") && req->getParam("persist")->value() == "1";
+			uint32_t timeout = req->hasParam("timeout") ? toULong(req->getParam("timeout")->value()) : 5000;
+			req->send(it->second.bridge->startAutoBaud(persist, timeout) ? 202 : 409);
+		}
+	);
+
+	// json config api, applies live like the save buttons
+	std::vector<SerialBridge*> bridges;
+	for (auto& [code, settings] : m_bridges) bridges.push_back(settings.bridge);
+	configApiRegister(server, bridges);
+
+	// hot path trace dump, only in TRACE_ENABLED builds
+	TRACE_REGISTER(server);
+
 	for (;;) {
-		delay(500);
+		// scans finish in the background, refresh the list when a new one lands
+		if (m_scanGeneration != wifiScanGeneration()) {
+			m_scanGeneration = wifiScanGeneration();
+			updateNetworkOptions();
+		}
+		updateSelfTestResults();
+		updateAutoBaudResults();
+		updateBridgeControls();
+		updateBridgeStatus();
+		pushStatus();
+		delay(kRefreshMs);
 	}
 }
 
@@ -115,10 +252,18 @@ void UserInterface::addSerialBridge(SerialBridge& bridge)
 	// 
 	auto [it, _] = m_bridges.emplace(bridge.code(), BridgeSettings{ &bridge, this });
 	BridgeSettings* settings = &it->second;
+	bridge.setMonitor(monitorCallback, this);
 	
 	// bridge tab
 	auto tab = ESPUI.addControl(Tab, "", bridge.name().c_str());
 	
+	// live status, refreshed by the ui task
+	ESPUI.addControl(Separator, "Status", "", None, tab);
+	int linkState = ESPUI.addControl(Label, "Connection", SerialBridge::toString(bridge.linkState()), None, tab);
+	int remoteAddress = ESPUI.addControl(Label, "Peer", "-", None, tab);
+	int traffic = ESPUI.addControl(Label, "Traffic", "-", None, tab);
+	int queueDelay = ESPUI.addControl(Label, "Queueing Delay", "-", None, tab);
+	
 	// tcp settings
 	ESPUI.addControl(Separator, "Bridge Settings", "", None, tab);
 	int bridgeTypeControl = ESPUI.addControl(Select, "Type", SerialBridge::toString(bridge.type()), Wetasphalt, tab, tcpTypeChangedCallback, (void*)settings);
@@ -128,6 +273,13 @@ void UserInterface::addSerialBridge(SerialBridge& bridge)
 	}
 	int tcpHostControl = ESPUI.addControl(Text, "Host", bridge.host(), None, tab, nullCallback, (void*)settings);
 	int tcpPortControl = ESPUI.addControl(Number, "Port", String(bridge.port()), None, tab, nullCallback, (void*)settings);
+	int rfc2217Control = ESPUI.addControl(Switcher, "RFC 2217", bridge.rfc2217() ? "1" : "0", None, tab, nullCallback, (void*)settings);
+	int qosControl = ESPUI.addControl(Select, "QoS", SerialBridge::toString(bridge.qos()), Wetasphalt, tab, nullCallback, (void*)settings);
+	for (uint8_t i = 0; i < static_cast<uint8_t>(SerialBridge::QosClass::COUNT); ++i) {
+		const char* cStr = SerialBridge::toCString(static_cast<SerialBridge::QosClass>(i));
+		ESPUI.addControl(Option, cStr, cStr, None, qosControl);
+	}
+	int rateLimitControl = ESPUI.addControl(Number, "Rate Limit (B/s, 0 = off)", String(bridge.rateLimit()), None, tab, nullCallback, (void*)settings);
 	
 	// serial settings
 	ESPUI.addControl(Separator, "Serial Settings", "", None, tab);
@@ -140,9 +292,46 @@ void UserInterface::addSerialBridge(SerialBridge& bridge)
 	int hasEcho = ESPUI.addControl(Switcher, "Has Echo", bridge.hasEcho() ? "1" : "0", None, tab, nullCallback, (void*)settings);
 	int simulateEcho = ESPUI.addControl(Switcher, "Simulate Echo", bridge.simulateEcho() ? "1" : "0", None, tab, nullCallback, (void*)settings);
 	
+	// rs485 and detection only make sense on a real uart
+	int rs485 = -1, rs485DePin = -1, autoBaudPersist = -1, autoBaudResult = -1;
+	if (bridge.isUart()) {
+		rs485 = ESPUI.addControl(Switcher, "RS-485", bridge.rs485() ? "1" : "0", None, tab, nullCallback, (void*)settings);
+		rs485DePin = ESPUI.addControl(Number, "DE/RE Pin", String(bridge.rs485DePin()), None, tab, nullCallback, (void*)settings);
+		autoBaudPersist = ESPUI.addControl(Switcher, "Save Detected Settings", "0", None, tab, nullCallback, (void*)settings);
+		ESPUI.addControl(Button, "Auto Detect", "Detect", Peterriver, tab, autoBaudCallback, (void*)settings);
+		autoBaudResult = ESPUI.addControl(Label, "Detection", "-", None, tab);
+	}
+	
+	// byte transforms between uart and network
+	ESPUI.addControl(Separator, "Transforms", "", None, tab);
+	uint8_t rxFlags = bridge.transforms(SerialBridge::Direction::SERIAL_TO_LINK);
+	uint8_t txFlags = bridge.transforms(SerialBridge::Direction::LINK_TO_SERIAL);
+	for (uint8_t t = 0; t < 5; ++t) {
+		uint8_t dirs = ((rxFlags >> t) & 1) | (((txFlags >> t) & 1) << 1);
+		int select = ESPUI.addControl(Select, kTransformLabels[t], kTransformDirections[dirs], Wetasphalt, tab, nullCallback, (void*)settings);
+		for (const char* option : kTransformDirections) ESPUI.addControl(Option, option, option, None, select);
+		settings->transformControls[t] = select;
+	}
+	
+	// loopback self test, needs TX wired to RX (uart) or a loopback plug behind the bridge (tcp)
+	int selfTestMode = -1, selfTestRate = -1, selfTestDuration = -1, selfTestResult = -1;
+	if (bridge.isUart()) {
+		ESPUI.addControl(Separator, "Self Test", "", None, tab);
+		selfTestMode = ESPUI.addControl(Select, "Mode", SerialBridge::toString(SerialBridge::SelfTestMode::UART_LOOPBACK), Wetasphalt, tab, nullCallback, (void*)settings);
+		for (uint8_t i = 0; i < static_cast<uint8_t>(SerialBridge::SelfTestMode::COUNT); ++i) {
+			const char* cStr = SerialBridge::toCString(static_cast<SerialBridge::SelfTestMode>(i));
+			ESPUI.addControl(Option, cStr, cStr, None, selfTestMode);
+		}
+		selfTestRate = ESPUI.addControl(Number, "Rate (B/s, 0 = line rate)", "0", None, tab, nullCallback, (void*)settings);
+		selfTestDuration = ESPUI.addControl(Number, "Duration (ms)", "5000", None, tab, nullCallback, (void*)settings);
+		ESPUI.addControl(Button, "Run", "Run", Peterriver, tab, selfTestCallback, (void*)settings);
+		selfTestResult = ESPUI.addControl(Label, "Results", "-", None, tab);
+	}
+	
 	// save button
 	auto save = ESPUI.addControl(Button, "Save", "Save", Peterriver, tab, submittedBridgeDetailsCallback, (void*)settings);
 	ESPUI.addControl(Button, "", "Restart", Peterriver, save, restartCallback, nullptr);
+	int saveResult = ESPUI.addControl(Label, "Save Result", "-", None, tab);
 	
 	settings->bridgeTypeControl = bridgeTypeControl;
 	settings->tcpHostControl = tcpHostControl;
@@ -151,6 +340,25 @@ void UserInterface::addSerialBridge(SerialBridge& bridge)
 	settings->serialFormatControl = serialFormatControl;
 	settings->serialHasEchoControl = hasEcho;
 	settings->serialSimulateEchoControl = simulateEcho;
+	settings->rfc2217Control = rfc2217Control;
+	settings->rs485Control = rs485;
+	settings->rs485DePinControl = rs485DePin;
+	settings->qosControl = qosControl;
+	settings->rateLimitControl = rateLimitControl;
+	settings->selfTestModeControl = selfTestMode;
+	settings->selfTestRateControl = selfTestRate;
+	settings->selfTestDurationControl = selfTestDuration;
+	settings->selfTestResultControl = selfTestResult;
+	settings->selfTestGeneration = bridge.selfTestGeneration();
+	settings->autoBaudPersistControl = autoBaudPersist;
+	settings->autoBaudResultControl = autoBaudResult;
+	settings->autoBaudGeneration = bridge.autoBaudGeneration();
+	settings->linkStateControl = linkState;
+	settings->remoteAddressControl = remoteAddress;
+	settings->trafficControl = traffic;
+	settings->queueDelayControl = queueDelay;
+	settings->saveResultControl = saveResult;
+	settings->configGeneration = bridge.configGeneration();
 	
 	// 
 	tcpTypeChangedCallback(nullptr, 0, (void*)settings);
@@ -161,11 +369,36 @@ void UserInterface::addWifiSettingsTab()
 	String ssid, pass, hostname;
 	wifiGetConfig(&ssid, &pass, &hostname);
 	auto wifitab = ESPUI.addControl(Tab, "", "WiFi Credentials");
+	this->m_networksControl = ESPUI.addControl(Select, "Networks", "", Alizarin, wifitab, networkSelectedCallback, (void*)this);
+	ESPUI.addControl(Button, "", "Scan", Peterriver, this->m_networksControl, scanCallback, nullptr);
+	for (size_t i = 0; i < kMaxNetworkOptions; ++i) {
+		m_networkLabels[i][0] = 0;
+		m_networkOptions[i] = ESPUI.addControl(Option, m_networkLabels[i], "", None, this->m_networksControl);
+		ESPUI.updateVisibility(m_networkOptions[i], false);
+	}
 	this->m_ssidControl = ESPUI.addControl(Text, "SSID", ssid.c_str(), Alizarin, wifitab);
 	//Note that adding a "Max" control to a text control sets the max length
 	ESPUI.addControl(Max, "", "32", None, this->m_ssidControl);
 	this->m_passwordControl = ESPUI.addControl(Text, "Password", pass.c_str(), Alizarin, wifitab);
 	ESPUI.addControl(Max, "", "64", None, this->m_passwordControl);
+	
+	// static ip, dhcp when off
+	bool staticIp;
+	IPAddress ip, gw, mask, dns;
+	wifiGetStaticIp(&staticIp, &ip, &gw, &mask, &dns);
+	ESPUI.addControl(Separator, "IP Settings", "", None, wifitab);
+	this->m_staticIpControl = ESPUI.addControl(Switcher, "Static IP", staticIp ? "1" : "0", None, wifitab, nullCallback, (void*)this);
+	this->m_ipControl = ESPUI.addControl(Text, "IP Address", ip.toString(), None, wifitab, nullCallback, (void*)this);
+	this->m_gatewayControl = ESPUI.addControl(Text, "Gateway", gw.toString(), None, wifitab, nullCallback, (void*)this);
+	this->m_maskControl = ESPUI.addControl(Text, "Subnet Mask", mask.toString(), None, wifitab, nullCallback, (void*)this);
+	this->m_dnsControl = ESPUI.addControl(Text, "DNS", dns.toString(), None, wifitab, nullCallback, (void*)this);
+	
+	// reconnect behaviour
+	bool fastIp, roam;
+	wifiGetOptions(&fastIp, &roam);
+	ESPUI.addControl(Separator, "Reconnect", "", None, wifitab);
+	this->m_fastIpControl = ESPUI.addControl(Switcher, "Reuse DHCP Lease (needs a reservation)", fastIp ? "1" : "0", None, wifitab, nullCallback, (void*)this);
+	this->m_roamControl = ESPUI.addControl(Switcher, "Roam to Stronger AP", roam ? "1" : "0", None, wifitab, nullCallback, (void*)this);
 	ESPUI.addControl(Button, "Save", "Save", Peterriver, wifitab, submittedWifiDetailsCallback, (void*)this);
 }
 
@@ -175,15 +408,165 @@ void UserInterface::addLogsTab()
 	ESPUI.addControl(Label, "", "<iframe src=\"/logs\" style=\"width:100\%;height:70vh;border:0;border-radius:8px;overflow:hidden\"></iframe>", None, tab);
 }
 
+void UserInterface::updateNetworkOptions()
+{
+	// strongest first, the options only change content so the browsers keep their page
+	std::vector<WifiNetwork> networks = wifiGetAvailableNetworks();
+	for (size_t i = 0; i < kMaxNetworkOptions; ++i) {
+		Control* option = ESPUI.getControl(m_networkOptions[i]);
+		if (!option) continue;
+		bool used = i < networks.size();
+		if (used) {
+			const WifiNetwork& net = networks[i];
+			snprintf(m_networkLabels[i], sizeof(m_networkLabels[i]), "%s (%d dBm%s)", net.ssid.c_str(), (int)net.rssi, net.open ? ", open" : "");
+			option->value = net.ssid;
+		} else {
+			m_networkLabels[i][0] = 0;
+			option->value = "";
+		}
+		option->label = m_networkLabels[i];
+		ESPUI.updateControl(option);
+		ESPUI.updateVisibility(m_networkOptions[i], used);
+	}
+}
+
+void UserInterface::updateSelfTestResults()
+{
+	for (auto& [code, settings] : m_bridges) {
+		if (settings.selfTestResultControl < 0) continue;
+		if (settings.selfTestGeneration == settings.bridge->selfTestGeneration()) continue;
+		settings.selfTestGeneration = settings.bridge->selfTestGeneration();
+		
+		SelfTestResults res = settings.bridge->selfTestResults();
+		char text[200];
+		snprintf(text, sizeof(text), "%u B/s, BER %.2e, loss %.2e (%u bad frames)<br>latency p50 %u us, p95 %u us, p99 %u us, max %u us",
+			res.throughputBps, res.bitErrorRate, res.byteLossRate, res.framesBad,
+			res.latencyP50Us, res.latencyP95Us, res.latencyP99Us, res.latencyMaxUs);
+		setStatus(settings.selfTestResultControl, text);
+	}
+}
+
+void UserInterface::updateAutoBaudResults()
+{
+	for (auto& [code, settings] : m_bridges) {
+		if (settings.autoBaudResultControl < 0) continue;
+		if (settings.autoBaudGeneration == settings.bridge->autoBaudGeneration()) continue;
+		settings.autoBaudGeneration = settings.bridge->autoBaudGeneration();
+		
+		SerialBridge::AutoBaudResult res = settings.bridge->autoBaudResult();
+		String text = res.locked
+			? "Locked on " + String(res.baud) + " " + SerialBridge::toString(res.fmt)
+			: "No lock, kept " + String(res.baud) + " " + SerialBridge::toString(res.fmt);
+		text += " in " + String(res.lockMs) + " ms (" + String(res.candidates) + " candidates)";
+		setStatus(settings.autoBaudResultControl, text);
+		
+		// show what the port runs at now, saving the form keeps it
+		setStatus(settings.serialBaudrateControl, String(res.baud), true);
+		setStatus(settings.serialFormatControl, SerialBridge::toString(res.fmt), true);
+	}
+}
+
+void UserInterface::updateBridgeStatus()
+{
+	for (auto& [code, settings] : m_bridges) {
+		SerialBridge* bridge = settings.bridge;
+		String state = SerialBridge::toString(bridge->linkState());
+		if (bridge->paused()) state += " (paused for a test)";
+		setStatus(settings.linkStateControl, state);
+		
+		String remote = bridge->remoteAddress();
+		setStatus(settings.remoteAddressControl, remote.length() ? remote : "-");
+		
+		const SerialBridge::Stats& stats = bridge->stats();
+		setStatus(settings.trafficControl, "rx " + String(stats.serialRxBytes) + " B, tx " + String(stats.serialTxBytes) + " B, " + String(stats.connections) + " connections");
+		setStatus(settings.queueDelayControl, "avg " + String(stats.queueDelayAvgUs) + " us, max " + String(stats.queueDelayMaxUs) + " us<br>"
+			+ String(stats.sendsDeferred) + " deferred, " + String(stats.sendsThrottled) + " throttled, " + String(stats.serialOverruns) + " rx overruns");
+	}
+}
+
+void UserInterface::setStatus(int control, const String& value, bool refresh)
+{
+	if (control < 0) return;
+	std::lock_guard<std::mutex> lock(m_statusMutex);
+	StatusValue& status = m_status[control];
+	status.wanted = value;
+	status.pending |= refresh || value != status.sent;
+}
+
+void UserInterface::pushStatus()
+{
+	// nobody is looking, keep only the latest values until a browser connects
+	if (!ESPUI.ws || ESPUI.ws->count() == 0) return;
+	
+	// collect first, ESPUI has locks of its own; everything set since the last tick goes out in this one pass
+	std::vector<std::pair<int, String>> changed;
+	{
+		std::lock_guard<std::mutex> lock(m_statusMutex);
+		for (auto& [control, status] : m_status) {
+			if (!status.pending) continue;
+			status.pending = false;
+			status.sent = status.wanted;
+			changed.emplace_back(control, status.sent);
+		}
+	}
+	for (auto& [control, value] : changed) ESPUI.updateControlValue(control, value);
+}
+
+void UserInterface::updateBridgeControls()
+{
+	// config changed through the api (or a save), show what the bridge runs with now
+	for (auto& [code, settings] : m_bridges) {
+		SerialBridge* bridge = settings.bridge;
+		if (settings.configGeneration == bridge->configGeneration()) continue;
+		settings.configGeneration = bridge->configGeneration();
+		
+		// the values go out with the status labels, the browser may hold unsaved edits so all are refreshed
+		setStatus(settings.bridgeTypeControl, SerialBridge::toString(bridge->type()), true);
+		setStatus(settings.tcpHostControl, bridge->host(), true);
+		setStatus(settings.tcpPortControl, String(bridge->port()), true);
+		setStatus(settings.rfc2217Control, bridge->rfc2217() ? "1" : "0", true);
+		setStatus(settings.qosControl, SerialBridge::toString(bridge->qos()), true);
+		setStatus(settings.rateLimitControl, String(bridge->rateLimit()), true);
+		setStatus(settings.serialBaudrateControl, String(bridge->baud()), true);
+		setStatus(settings.serialFormatControl, SerialBridge::toString(bridge->format()), true);
+		setStatus(settings.serialHasEchoControl, bridge->hasEcho() ? "1" : "0", true);
+		setStatus(settings.serialSimulateEchoControl, bridge->simulateEcho() ? "1" : "0", true);
+		if (settings.rs485Control >= 0) {
+			setStatus(settings.rs485Control, bridge->rs485() ? "1" : "0", true);
+			setStatus(settings.rs485DePinControl, String(bridge->rs485DePin()), true);
+		}
+		
+		uint8_t rxFlags = bridge->transforms(SerialBridge::Direction::SERIAL_TO_LINK);
+		uint8_t txFlags = bridge->transforms(SerialBridge::Direction::LINK_TO_SERIAL);
+		for (uint8_t t = 0; t < 5; ++t) {
+			uint8_t dirs = ((rxFlags >> t) & 1) | (((txFlags >> t) & 1) << 1);
+			setStatus(settings.transformControls[t], kTransformDirections[dirs], true);
+		}
+		
+		// the type select still shows the old value until the next push, go by the bridge
+		updateTypeVisibility(&settings, bridge->type());
+	}
+}
+
 void tcpTypeChangedCallback(Control *sender, int type, void* arg)
 {
+	TRACE_SCOPE("ui.typeChanged");
 	UserInterface::BridgeSettings* bridgeSettings = (UserInterface::BridgeSettings*)arg;
 	
-	if (ESPUI.getControl(bridgeSettings->bridgeTypeControl)->value == SerialBridge::toString(SerialBridge::BridgeType::TCP_CLIENT)) {
+	updateTypeVisibility(bridgeSettings, SerialBridge::fromTypeString(ESPUI.getControl(bridgeSettings->bridgeTypeControl)->value));
+}
+
+static void updateTypeVisibility(UserInterface::BridgeSettings* bridgeSettings, SerialBridge::BridgeType bType)
+{
+	if (bType == SerialBridge::BridgeType::TCP_CLIENT) {
 		ESPUI.updateVisibility(bridgeSettings->tcpHostControl, true);
 	} else {
 		ESPUI.updateVisibility(bridgeSettings->tcpHostControl, false);
 	}
+	
+	// only plain tcp bridges have a port of their own, multiplexed bridges share the mux port
+	ESPUI.updateVisibility(bridgeSettings->tcpPortControl, bType == SerialBridge::BridgeType::TCP_SERVER || bType == SerialBridge::BridgeType::TCP_CLIENT);
+	ESPUI.updateVisibility(bridgeSettings->rfc2217Control, bType == SerialBridge::BridgeType::TCP_SERVER);
 }
 
 void switchChangedCallback(Control *sender, int type, void* arg)
@@ -193,21 +576,78 @@ void switchChangedCallback(Control *sender, int type, void* arg)
 
 void nullCallback(Control *sender, int type, void* arg) {}
 
+void monitorCallback(SerialBridge* bridge, SerialBridge::Direction dir, const uint8_t* data, size_t len, void* arg)
+{
+	// runs on the bridge task, leave right away when nobody is watching or the socket is backed up
+	UserInterface* ui = (UserInterface*)arg;
+	if (ui->m_monitorWs.count() == 0 || !ui->m_monitorWs.availableForWriteAll()) return;
+	
+	char line[24 + 3 * kMonitorBytes + 24];
+	int n = snprintf(line, sizeof(line), "%.16s %s", bridge->code().c_str(), dir == SerialBridge::Direction::SERIAL_TO_LINK ? ">" : "<");
+	for (size_t i = 0; i < len && i < kMonitorBytes; ++i) n += snprintf(line + n, sizeof(line) - n, " %02x", data[i]);
+	if (len > kMonitorBytes) n += snprintf(line + n, sizeof(line) - n, " ... (%u bytes)", (unsigned)len);
+	ui->m_monitorWs.textAll(line, n);
+}
+
 void submittedBridgeDetailsCallback(Control *sender, int type, void* arg)
 {
+	TRACE_SCOPE("ui.saveBridge");
 	if (type != B_UP) return;
 	
 	UserInterface::BridgeSettings* bridgeSettings = (UserInterface::BridgeSettings*)arg;
 	SerialBridge::BridgeType bType = SerialBridge::fromTypeString(ESPUI.getControl(bridgeSettings->bridgeTypeControl)->value);
 	String host = ESPUI.getControl(bridgeSettings->tcpHostControl)->value;
-	ushort port = ESPUI.getControl(bridgeSettings->tcpPortControl)->value.toInt();
+	long port = ESPUI.getControl(bridgeSettings->tcpPortControl)->value.toInt();
 	ulong baud = toULong(ESPUI.getControl(bridgeSettings->serialBaudrateControl)->value);
 	SerialBridge::SerialFormat fmt = SerialBridge::fromFormatString(ESPUI.getControl(bridgeSettings->serialFormatControl)->value);
 	bool hasEcho = ESPUI.getControl(bridgeSettings->serialHasEchoControl)->value == "0" ? false : true;
 	bool simulateEcho = ESPUI.getControl(bridgeSettings->serialSimulateEchoControl)->value == "0" ? false : true;
+	bool rfc2217 = ESPUI.getControl(bridgeSettings->rfc2217Control)->value == "0" ? false : true;
+	
+	// update bridge settings, serial settings are applied live; nothing is saved when they do not check out
+	String error;
+	if (port < 1 || port > 65535) error = "invalid port";
+	else bridgeSettings->bridge->setConfig(bType, host, (ushort)port, baud, fmt, hasEcho, simulateEcho, rfc2217, &error);
+	if (error.length()) {
+		bridgeSettings->ui->setStatus(bridgeSettings->saveResultControl, "Not saved: " + error);
+		return;
+	}
+	bridgeSettings->ui->setStatus(bridgeSettings->saveResultControl, "Saved");
+	
+	if (bridgeSettings->rs485Control >= 0) {
+		bool rs485 = ESPUI.getControl(bridgeSettings->rs485Control)->value == "0" ? false : true;
+		long dePin = ESPUI.getControl(bridgeSettings->rs485DePinControl)->value.toInt();
+		if (SerialBridge::isValidDePin(dePin)) {
+			bridgeSettings->bridge->setRs485Config(rs485, (int8_t)dePin);
+		} else {
+			// keep the old settings and show them again
+			Log.warningln("UserInterface(%s) invalid DE pin %d, RS-485 settings not saved", bridgeSettings->bridge->code().c_str(), (int)dePin);
+			ESPUI.updateSwitcher(bridgeSettings->rs485Control, bridgeSettings->bridge->rs485());
+			ESPUI.updateNumber(bridgeSettings->rs485DePinControl, bridgeSettings->bridge->rs485DePin());
+		}
+	}
+	
+	uint8_t rxFlags = 0, txFlags = 0;
+	for (uint8_t t = 0; t < 5; ++t) {
+		const String& value = ESPUI.getControl(bridgeSettings->transformControls[t])->value;
+		for (uint8_t dirs = 0; dirs < 4; ++dirs) {
+			if (value != kTransformDirections[dirs]) continue;
+			if (dirs & 1) rxFlags |= 1 << t;
+			if (dirs & 2) txFlags |= 1 << t;
+		}
+	}
+	bridgeSettings->bridge->setTransforms(rxFlags, txFlags);
 	
-	// update bridge settings
-	bridgeSettings->bridge->setConfig(bType, host, port, baud, fmt, hasEcho, simulateEcho);
+	SerialBridge::QosClass qos = SerialBridge::fromQosString(ESPUI.getControl(bridgeSettings->qosControl)->value);
+	uint32_t rateLimit = toULong(ESPUI.getControl(bridgeSettings->rateLimitControl)->value);
+	uint32_t clamped = rateLimit;
+	if (clamped && clamped < SerialBridge::kMinRateLimit) clamped = SerialBridge::kMinRateLimit;
+	if (clamped > SerialBridge::kMaxRateLimit) clamped = SerialBridge::kMaxRateLimit;
+	if (clamped != rateLimit) {
+		Log.warningln("UserInterface(%s) rate limit %u out of range, using %u", bridgeSettings->bridge->code().c_str(), rateLimit, clamped);
+		ESPUI.updateNumber(bridgeSettings->rateLimitControl, clamped);
+	}
+	bridgeSettings->bridge->setQos(qos, clamped);
 }
 
 void restartCallback(Control *sender, int type, void* arg)
@@ -216,10 +656,67 @@ void restartCallback(Control *sender, int type, void* arg)
 	ESP.restart();
 }
 
+void networkSelectedCallback(Control *sender, int type, void* arg)
+{
+	TRACE_SCOPE("ui.networkSelected");
+	UserInterface* ui = (UserInterface*)arg;
+	ESPUI.updateText(ui->m_ssidControl, sender->value);
+}
+
+void scanCallback(Control *sender, int type, void* arg)
+{
+	TRACE_SCOPE("ui.scan");
+	if (type != B_UP) return;
+	wifiStartScan();
+}
+
+void selfTestCallback(Control *sender, int type, void* arg)
+{
+	TRACE_SCOPE("ui.selfTest");
+	if (type != B_UP) return;
+	
+	UserInterface::BridgeSettings* bridgeSettings = (UserInterface::BridgeSettings*)arg;
+	SerialBridge::SelfTestMode mode = SerialBridge::fromSelfTestModeString(ESPUI.getControl(bridgeSettings->selfTestModeControl)->value);
+	uint32_t rate = toULong(ESPUI.getControl(bridgeSettings->selfTestRateControl)->value);
+	uint32_t duration = toULong(ESPUI.getControl(bridgeSettings->selfTestDurationControl)->value);
+	
+	if (bridgeSettings->bridge->startSelfTest(mode, rate, duration)) {
+		bridgeSettings->ui->setStatus(bridgeSettings->selfTestResultControl, "Running...");
+	} else {
+		bridgeSettings->ui->setStatus(bridgeSettings->selfTestResultControl, "Cannot start, a test is running or the bridge is not a TCP server");
+	}
+}
+
+void autoBaudCallback(Control *sender, int type, void* arg)
+{
+	TRACE_SCOPE("ui.autoBaud");
+	if (type != B_UP) return;
+	
+	UserInterface::BridgeSettings* bridgeSettings = (UserInterface::BridgeSettings*)arg;
+	bool persist = ESPUI.getControl(bridgeSettings->autoBaudPersistControl)->value == "0" ? false : true;
+	
+	if (bridgeSettings->bridge->startAutoBaud(persist, 5000)) {
+		bridgeSettings->ui->setStatus(bridgeSettings->autoBaudResultControl, "Detecting...");
+	} else {
+		bridgeSettings->ui->setStatus(bridgeSettings->autoBaudResultControl, "Cannot start, a test or detection is running");
+	}
+}
+
 void submittedWifiDetailsCallback(Control *sender, int type, void* arg)
 {
+	TRACE_SCOPE("ui.saveWifi");
 	if (type != B_UP) return;
 	
 	UserInterface* ui = (UserInterface*)arg;
+	IPAddress ip, gw, mask, dns;
+	ip.fromString(ESPUI.getControl(ui->m_ipControl)->value);
+	gw.fromString(ESPUI.getControl(ui->m_gatewayControl)->value);
+	mask.fromString(ESPUI.getControl(ui->m_maskControl)->value);
+	dns.fromString(ESPUI.getControl(ui->m_dnsControl)->value);
+	bool staticIp = ESPUI.getControl(ui->m_staticIpControl)->value == "0" ? false : true;
+	wifiSetStaticIp(staticIp, ip, gw, mask, dns);
+	bool fastIp = ESPUI.getControl(ui->m_fastIpControl)->value == "0" ? false : true;
+	bool roam = ESPUI.getControl(ui->m_roamControl)->value == "0" ? false : true;
+	wifiSetOptions(fastIp, roam);
 	wifiConnect(ESPUI.getControl(ui->m_ssidControl)->value, ESPUI.getControl(ui->m_passwordControl)->value);
 }
\ No newline at end of file
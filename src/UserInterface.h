@@ -2,18 +2,23 @@
 
 #include <ESPUI.h>
 #include <map>
+#include <mutex>
+#include <vector>
 
 #include "SerialBridge.h"
 #include "PrintUtils.h"
 
 class UserInterface {
   public:
-    UserInterface() : m_logWs("/logws"), m_wsPrint(&m_logWs) {}
+    UserInterface() : m_logWs("/logws"), m_wsPrint(&m_logWs), m_monitorWs("/monitorws") {}
 
     void addSerialBridge(SerialBridge& bridge);
     Print* logPrint() { return &m_wsPrint; }
 
     void start();
+    // label text or control value, safe from any task; only changed values go out, once per refresh.
+    // refresh sends it even when unchanged, for inputs a browser may have edited since
+    void setStatus(int control, const String& value, bool refresh = false);
 
     struct BridgeSettings {
       SerialBridge* bridge;
@@ -25,22 +30,78 @@ class UserInterface {
       int serialFormatControl;
       int serialHasEchoControl;
       int serialSimulateEchoControl;
+      int rfc2217Control;
+      int rs485Control;
+      int rs485DePinControl;
+      int qosControl;
+      int rateLimitControl;
+      int transformControls[5];   // one per ByteTransform::Flag bit
+      int selfTestModeControl;
+      int selfTestRateControl;
+      int selfTestDurationControl;
+      int selfTestResultControl;
+      uint32_t selfTestGeneration;
+      int autoBaudPersistControl;
+      int autoBaudResultControl;
+      uint32_t autoBaudGeneration;
+      int linkStateControl;
+      int remoteAddressControl;
+      int trafficControl;
+      int queueDelayControl;
+      int saveResultControl;
+      uint32_t configGeneration;
     };
 
   private:
 
+    static constexpr uint32_t kRefreshMs = 500;
+
+    struct StatusValue {
+      String wanted;
+      String sent;
+      bool pending = false;
+    };
+
     std::map<String, BridgeSettings> m_bridges;
+    std::map<int, StatusValue> m_status;
+    std::mutex m_statusMutex;
     int m_ssidControl;
     int m_passwordControl;
+    static constexpr size_t kMaxNetworkOptions = 12;
+
+    int m_networksControl;
+    // fixed set of options, refilled in place after each scan; ESPUI keeps the label pointers
+    int m_networkOptions[kMaxNetworkOptions];
+    char m_networkLabels[kMaxNetworkOptions][48];
+    uint32_t m_scanGeneration = 0;
+    int m_staticIpControl;
+    int m_ipControl;
+    int m_gatewayControl;
+    int m_maskControl;
+    int m_dnsControl;
+    int m_fastIpControl;
+    int m_roamControl;
     AsyncWebSocket m_logWs;
     WebSocketPrint m_wsPrint;
+    // live hex dump of bridge traffic, one line per chunk
+    AsyncWebSocket m_monitorWs;
 
     void addWifiSettingsTab();
     void addLogsTab();
+    void updateNetworkOptions();
+    void updateSelfTestResults();
+    void updateAutoBaudResults();
+    void updateBridgeControls();
+    void updateBridgeStatus();
+    void pushStatus();
     void task();
 
     friend void tcpTypeChangedCallback(Control *sender, int type, void* arg);
     friend void submittedBridgeDetailsCallback(Control *sender, int type, void* arg);
     friend void submittedWifiDetailsCallback(Control *sender, int type, void* arg);
+    friend void networkSelectedCallback(Control *sender, int type, void* arg);
+    friend void selfTestCallback(Control *sender, int type, void* arg);
+    friend void autoBaudCallback(Control *sender, int type, void* arg);
     friend void nullCallback(Control *sender, int type, void* arg);
+    friend void monitorCallback(SerialBridge* bridge, SerialBridge::Direction dir, const uint8_t* data, size_t len, void* arg);
 };
\ No newline at end of file
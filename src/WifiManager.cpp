@@ -3,6 +3,8 @@
 #include <WiFi.h>
 #include <ESPmDNS.h>
 #include <Preferences.h>
+#include <algorithm>
+#include <mutex>
 #include <vector>
 
 #include "WifiManager.h"
@@ -11,22 +13,79 @@
 
 Preferences prefs;
 
+struct WifiCache {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip, gw, mask, dns;
+};
+
+static volatile uint32_t g_disconnectedAt = 0;
+static volatile uint32_t g_lastReconnectMs = 0;
+static volatile bool g_fastPath = false;
+// set once the current outage had its go at the cached ap
+static volatile bool g_cachedTried = true;
+// the event callback runs in the wifi driver's context, the cache is written from the wifi task
+static volatile bool g_saveCachePending = false;
+static volatile bool g_roam = false;
+
+static constexpr uint32_t kScanMinIntervalMs = 30000;
+// a cached ap that answers connects well within this, past it the ap is taken as gone and we scan
+static constexpr uint32_t kFastPathTimeoutMs = 3000;
+static constexpr uint32_t kConnectTimeoutMs = 5000;
+static std::mutex g_scanMutex;
+static std::vector<WifiNetwork> g_networks;
+static volatile uint32_t g_scanGeneration = 0;
+static volatile bool g_scanRunning = false;
+// the scan turned a plain access point into ap + sta, undone when it finishes
+static volatile bool g_scanAddedSta = false;
+static uint32_t g_lastScanAt = 0;
+static volatile uint32_t g_reconnectAt = 0;
+
+static bool wifiLoadCache(WifiCache* cache, bool* useLease);
+static void wifiSaveCache();
+static void wifiClearCache();
+static bool wifiBegin(bool fast);
+static void wifiRestoreScanMode();
+static void wifiTask(void*);
+
 void wifiInitialize() 
 {
   String hostname;
   wifiGetConfig(NULL, NULL, &hostname);
 
+  WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info) {
+    if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+      if (!g_disconnectedAt) g_disconnectedAt = millis() | 1;
+    } else if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+      if (g_disconnectedAt) {
+        g_lastReconnectMs = millis() - g_disconnectedAt;
+        g_disconnectedAt = 0;
+        Log.infoln("Wifi connected in %u ms (%s)", g_lastReconnectMs, g_fastPath ? "fast" : "full scan");
+      }
+      g_saveCachePending = true;
+    }
+  });
+
   // try to connect with stored credentials, fire up an access point if they don't work.
   WiFi.mode(WIFI_STA);
 	WiFi.hostname(hostname);
   WiFi.setSleep(false);
   WiFi.setAutoReconnect(true);
-  WiFi.begin();
+  g_disconnectedAt = millis() | 1;
 
-  WiFi.waitForConnectResult(5000);
+  // cached bssid and channel first, a full scan if that does not work; a stale cache costs
+  // kFastPathTimeoutMs on top of the scan, so boot blocks for up to 8 s before falling back to the ap
+  if (!wifiBegin(true) || WiFi.waitForConnectResult(g_fastPath ? kFastPathTimeoutMs : kConnectTimeoutMs) != WL_CONNECTED) {
+    if (g_fastPath) {
+      Log.infoln("Wifi fast connect failed, scanning...");
+      wifiClearCache();
+      wifiBegin(false);
+      WiFi.waitForConnectResult(kConnectTimeoutMs);
+    }
+  }
 	
 	if (WiFi.status() == WL_CONNECTED) {
-		Log.infoln("Wifi connected! IP address: %s", WiFi.localIP().toString());
+		Log.infoln("Wifi connected! IP address: %s", WiFi.localIP().toString().c_str());
 
 		if (!MDNS.begin(hostname)) {
 			Log.warningln("Error setting up MDNS responder!");
@@ -37,21 +96,35 @@ void wifiInitialize()
     WiFi.setSleep(false);
 		WiFi.softAPConfig(IPAddress(192, 168, 1, 1), IPAddress(192, 168, 1, 1), IPAddress(255, 255, 255, 0));
 		WiFi.softAP(hostname);
-    WiFi.waitForConnectResult(5000);
+    WiFi.waitForConnectResult(kConnectTimeoutMs);
 	}
+
+  xTaskCreate(wifiTask, "WifiManager", 3072, nullptr, 1, nullptr);
 }
 
 void wifiConnect(const String& ssid, const String& pass) {
-  Log.infoln("Connecting to %s:%s", ssid, pass);
+  Log.infoln("Connecting to %s", ssid.c_str());
   wifiSetConfig(&ssid, &pass);
+  wifiClearCache();
+  g_fastPath = false;
+  g_disconnectedAt = millis() | 1;
   WiFi.softAPdisconnect(true);
   WiFi.mode(WIFI_STA);
   WiFi.setSleep(false);
   WiFi.setAutoReconnect(true);
+  bool staticIp;
+  IPAddress ip, gw, mask, dns;
+  wifiGetStaticIp(&staticIp, &ip, &gw, &mask, &dns);
+  if (staticIp) WiFi.config(ip, gw, mask, dns);
+  else WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
   WiFi.persistent(true);
   WiFi.begin(ssid.c_str(), pass.c_str());
   WiFi.persistent(false);
-  WiFi.waitForConnectResult(5000);
+  WiFi.waitForConnectResult(kConnectTimeoutMs);
+}
+
+void wifiReconnectLater(uint32_t delayMs) {
+  g_reconnectAt = (millis() + delayMs) | 1;
 }
 
 void wifiGetConfig(String* ssid, String* pass, String* hostname) {
@@ -76,22 +149,290 @@ void wifiSetConfig(const String* ssid, const String* pass, const String* hostnam
   prefs.end();
 }
 
-std::vector<String> wifiGetAvailableNetworks() {
-  int n = WiFi.scanNetworks();
-  
-  Log.infoln("Scan complete. Found %d networks:", n);
-  for (int i = 0; i < n; ++i) {
-    Log.infoln("%2d: %s (RSSI: %d dBm)%s",
-      i + 1,
-      WiFi.SSID(i).c_str(),
-      WiFi.RSSI(i),
-      (WiFi.encryptionType(i) == WIFI_AUTH_OPEN) ? " OPEN" : "");
+std::vector<WifiNetwork> wifiGetAvailableNetworks() {
+  std::lock_guard<std::mutex> lock(g_scanMutex);
+  return g_networks;
+}
+
+uint32_t wifiScanGeneration() {
+  return g_scanGeneration;
+}
+
+bool wifiStartScan() {
+  // scanning takes the radio off channel, keep it rare
+  if (g_scanRunning) return false;
+  if (g_scanGeneration && millis() - g_lastScanAt < kScanMinIntervalMs) return false;
+
+  // an access point alone cannot scan
+  if (WiFi.getMode() == WIFI_AP) {
+    WiFi.mode(WIFI_AP_STA);
+    g_scanAddedSta = true;
+  }
+
+  if (WiFi.scanNetworks(true, false, false, 120) != WIFI_SCAN_RUNNING) {
+    Log.warningln("Wifi scan failed to start");
+    wifiRestoreScanMode();
+    return false;
+  }
+  g_scanRunning = true;
+  g_lastScanAt = millis();
+  return true;
+}
+
+static void wifiRestoreScanMode() {
+  if (!g_scanAddedSta) return;
+  g_scanAddedSta = false;
+  // a connect in the meantime picked its own mode, leave that alone
+  if (WiFi.getMode() == WIFI_AP_STA) WiFi.mode(WIFI_AP);
+}
+
+static void wifiCollectScan() {
+  int16_t n = WiFi.scanComplete();
+  if (n == WIFI_SCAN_RUNNING) return;
+  g_scanRunning = false;
+  wifiRestoreScanMode();
+  if (n < 0) return;
+
+  // strongest entry per ssid, strongest first
+  std::vector<WifiNetwork> networks;
+  for (int16_t i = 0; i < n; ++i) {
+    String ssid = WiFi.SSID(i);
+    if (!ssid.length()) continue;
+    auto it = std::find_if(networks.begin(), networks.end(), [&](const WifiNetwork& net) { return net.ssid == ssid; });
+    if (it != networks.end() && it->rssi >= WiFi.RSSI(i)) continue;
+    if (it == networks.end()) it = networks.insert(networks.end(), WifiNetwork());
+    it->ssid = ssid;
+    it->rssi = WiFi.RSSI(i);
+    it->channel = WiFi.channel(i);
+    it->open = WiFi.encryptionType(i) == WIFI_AUTH_OPEN;
+    memcpy(it->bssid, WiFi.BSSID(i), sizeof(it->bssid));
   }
+  std::sort(networks.begin(), networks.end(), [](const WifiNetwork& a, const WifiNetwork& b) { return a.rssi > b.rssi; });
 
   // free memory used by scan results
   WiFi.scanDelete();
 
-  return std::vector<String>();
+  Log.infoln("Scan complete. Found %d networks", networks.size());
+  {
+    std::lock_guard<std::mutex> lock(g_scanMutex);
+    g_networks.swap(networks);
+  }
+  g_scanGeneration++;
+}
+
+void wifiGetStaticIp(bool* enable, IPAddress* ip, IPAddress* gw, IPAddress* mask, IPAddress* dns) {
+  Preferences prefs;
+  if (!prefs.begin("wifi", true)) {
+    Log.warningln("Unable to open Wiress Preferences");
+  }
+  if (enable) *enable = prefs.getBool("sip", false);
+  if (ip) *ip = IPAddress(prefs.getULong("ip", 0));
+  if (gw) *gw = IPAddress(prefs.getULong("gw", 0));
+  if (mask) *mask = IPAddress(prefs.getULong("mask", 0));
+  if (dns) *dns = IPAddress(prefs.getULong("dns", 0));
+  prefs.end();
+}
+
+void wifiSetStaticIp(bool enable, const IPAddress& ip, const IPAddress& gw, const IPAddress& mask, const IPAddress& dns) {
+  Preferences prefs;
+  if (!prefs.begin("wifi", false)) {
+    Log.warningln("Unable to open Wiress Preferences");
+  }
+  prefs.putBool("sip", enable);
+  prefs.putULong("ip", (uint32_t)ip);
+  prefs.putULong("gw", (uint32_t)gw);
+  prefs.putULong("mask", (uint32_t)mask);
+  prefs.putULong("dns", (uint32_t)dns);
+  prefs.end();
+}
+
+void wifiGetOptions(bool* fastIp, bool* roam) {
+  Preferences prefs;
+  if (!prefs.begin("wifi", true)) {
+    Log.warningln("Unable to open Wiress Preferences");
+  }
+  if (fastIp) *fastIp = prefs.getBool("fastip", false);
+  if (roam) *roam = prefs.getBool("roam", false);
+  prefs.end();
+}
+
+void wifiSetOptions(bool fastIp, bool roam) {
+  Preferences prefs;
+  if (!prefs.begin("wifi", false)) {
+    Log.warningln("Unable to open Wiress Preferences");
+  }
+  prefs.putBool("fastip", fastIp);
+  prefs.putBool("roam", roam);
+  prefs.end();
+  g_roam = roam;
+}
+
+uint32_t wifiLastReconnectMs() {
+  return g_lastReconnectMs;
+}
+
+static bool wifiLoadCache(WifiCache* cache, bool* useLease) {
+  Preferences prefs;
+  if (!prefs.begin("wifi", true)) return false;
+  bool ok = prefs.getBytes("bssid", cache->bssid, sizeof(cache->bssid)) == sizeof(cache->bssid);
+  cache->channel = prefs.getUChar("chan", 0);
+  cache->ip = prefs.getULong("cip", 0);
+  cache->gw = prefs.getULong("cgw", 0);
+  cache->mask = prefs.getULong("cmask", 0);
+  cache->dns = prefs.getULong("cdns", 0);
+  *useLease = prefs.getBool("fastip", false) && cache->ip != 0;
+  prefs.end();
+  return ok && cache->channel != 0;
+}
+
+static void wifiSaveCache() {
+  WifiCache cache, stored;
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = (uint32_t)WiFi.localIP();
+  cache.gw = (uint32_t)WiFi.gatewayIP();
+  cache.mask = (uint32_t)WiFi.subnetMask();
+  cache.dns = (uint32_t)WiFi.dnsIP();
+
+  // only touch flash when something changed
+  bool useLease;
+  if (wifiLoadCache(&stored, &useLease) && memcmp(cache.bssid, stored.bssid, sizeof(cache.bssid)) == 0 &&
+      cache.channel == stored.channel && cache.ip == stored.ip && cache.gw == stored.gw &&
+      cache.mask == stored.mask && cache.dns == stored.dns) return;
+
+  Preferences prefs;
+  if (!prefs.begin("wifi", false)) {
+    Log.warningln("Unable to open Wiress Preferences");
+    return;
+  }
+  prefs.putBytes("bssid", cache.bssid, sizeof(cache.bssid));
+  prefs.putUChar("chan", cache.channel);
+  prefs.putULong("cip", cache.ip);
+  prefs.putULong("cgw", cache.gw);
+  prefs.putULong("cmask", cache.mask);
+  prefs.putULong("cdns", cache.dns);
+  prefs.end();
+  Log.infoln("Wifi cached %s on channel %u", WiFi.BSSIDstr().c_str(), cache.channel);
+}
+
+static void wifiClearCache() {
+  Preferences prefs;
+  if (!prefs.begin("wifi", false)) return;
+  prefs.remove("bssid");
+  prefs.remove("chan");
+  prefs.end();
+}
+
+static bool wifiBegin(bool fast) {
+  String ssid, pass;
+  wifiGetConfig(&ssid, &pass);
+
+  bool staticIp;
+  IPAddress ip, gw, mask, dns;
+  wifiGetStaticIp(&staticIp, &ip, &gw, &mask, &dns);
+
+  WifiCache cache;
+  bool useLease = false;
+  g_fastPath = fast && ssid.length() && wifiLoadCache(&cache, &useLease);
+
+  // a cached lease skips DHCP entirely, only safe with a reservation so it is opt-in ("fastip")
+  if (staticIp) WiFi.config(ip, gw, mask, dns);
+  else if (g_fastPath && useLease) WiFi.config(IPAddress(cache.ip), IPAddress(cache.gw), IPAddress(cache.mask), IPAddress(cache.dns));
+  else WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+
+  if (g_fastPath) return WiFi.begin(ssid.c_str(), pass.c_str(), cache.channel, cache.bssid) != WL_CONNECT_FAILED;
+  if (ssid.length()) return WiFi.begin(ssid.c_str(), pass.c_str()) != WL_CONNECT_FAILED;
+  return WiFi.begin() != WL_CONNECT_FAILED;
+}
+
+static void wifiRoam() {
+  String ssid, pass;
+  wifiGetConfig(&ssid, &pass);
+  if (!ssid.length() || WiFi.status() != WL_CONNECTED) return;
+
+  // scan results keep the strongest ap per ssid
+  WifiNetwork best;
+  {
+    std::lock_guard<std::mutex> lock(g_scanMutex);
+    auto it = std::find_if(g_networks.begin(), g_networks.end(), [&](const WifiNetwork& net) { return net.ssid == ssid; });
+    if (it == g_networks.end()) return;
+    best = *it;
+  }
+
+  int current = WiFi.RSSI();
+  if (memcmp(best.bssid, WiFi.BSSID(), sizeof(best.bssid)) == 0 || best.rssi < current + 8) return;
+
+  Log.infoln("Wifi roaming from %d dBm to channel %u (%d dBm)", current, best.channel, best.rssi);
+  g_fastPath = true;
+  g_disconnectedAt = millis() | 1;
+  WiFi.begin(ssid.c_str(), pass.c_str(), best.channel, best.bssid);
+}
+
+static void wifiTask(void*) {
+  bool roam;
+  wifiGetOptions(nullptr, &roam);
+  g_roam = roam;
+  uint32_t lastRoamCheck = 0;
+  bool roamPending = false;
+
+  // without a network the list is what the user needs first
+  if (WiFi.getMode() == WIFI_AP) wifiStartScan();
+
+  for (;;) {
+    delay(500);
+
+    if (g_scanRunning) {
+      wifiCollectScan();
+      if (!g_scanRunning && roamPending) {
+        roamPending = false;
+        wifiRoam();
+      }
+    }
+
+    if (g_reconnectAt && (int32_t)(millis() - g_reconnectAt) >= 0) {
+      g_reconnectAt = 0;
+      String ssid, pass, hostname;
+      wifiGetConfig(&ssid, &pass, &hostname);
+      Log.infoln("Wifi applying new settings...");
+      WiFi.setHostname(hostname.c_str());
+      wifiConnect(ssid, pass);
+      continue;
+    }
+
+    if (WiFi.getMode() != WIFI_STA) continue;
+
+    if (g_saveCachePending && WiFi.status() == WL_CONNECTED) {
+      g_saveCachePending = false;
+      wifiSaveCache();
+    }
+    if (!g_disconnectedAt) g_cachedTried = false;
+
+    // an outage goes back through the cached ap first, the core's own reconnect scans every channel
+    WifiCache cache;
+    bool useLease;
+    if (g_disconnectedAt && !g_cachedTried) {
+      g_cachedTried = true;
+      if (!g_fastPath && wifiLoadCache(&cache, &useLease)) {
+        Log.infoln("Wifi reconnecting through the cached AP...");
+        wifiBegin(true);
+        continue;
+      }
+    }
+
+    // the core reconnects to the cached bssid, fall back to a full scan if that ap is gone
+    if (g_fastPath && g_disconnectedAt && millis() - g_disconnectedAt > kFastPathTimeoutMs) {
+      Log.infoln("Wifi cached AP unreachable, scanning...");
+      wifiClearCache();
+      wifiBegin(false);
+      continue;
+    }
+
+    // look for a stronger ap on the same ssid when the signal gets weak
+    if (g_roam && WiFi.status() == WL_CONNECTED && WiFi.RSSI() < -75 && millis() - lastRoamCheck > 60000) {
+      lastRoamCheck = millis();
+      roamPending = wifiStartScan();
+    }
+  }
 }
 
 String wifiGetHostname() {
@@ -1,9 +1,31 @@
 #pragma once
 
 #include <Arduino.h>
+#include <vector>
 
+struct WifiNetwork {
+  String ssid;
+  int32_t rssi;
+  uint8_t channel;
+  bool open;
+  uint8_t bssid[6];
+};
+
+// blocks until connected or given up, about 3 s on a stale cached ap plus 5 s for the full scan
 void wifiInitialize();
 void wifiConnect(const String& ssid, const String& pass);
+// reconnect with the stored settings from the wifi task, after delayMs so a pending response can go out
+void wifiReconnectLater(uint32_t delayMs);
 void wifiGetConfig(String* ssid, String* pass, String* hostname = NULL);
 void wifiSetConfig(const String* ssid, const String* pass, const String* hostname = NULL);
+void wifiGetStaticIp(bool* enable, IPAddress* ip, IPAddress* gw, IPAddress* mask, IPAddress* dns);
+void wifiSetStaticIp(bool enable, const IPAddress& ip, const IPAddress& gw, const IPAddress& mask, const IPAddress& dns);
+// fastIp reuses the last DHCP lease on reconnect (needs a reservation), roam moves to a stronger ap of the same ssid
+void wifiGetOptions(bool* fastIp, bool* roam);
+void wifiSetOptions(bool fastIp, bool roam);
+// time from the last disconnect (or boot) to getting an address, 0 before the first connect
+uint32_t wifiLastReconnectMs();
+bool wifiStartScan();
+std::vector<WifiNetwork> wifiGetAvailableNetworks();
+uint32_t wifiScanGeneration();
 String wifiGetHostname();
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "UserInterface.h"
 #include "WifiManager.h"
 #include "PrintUtils.h"
+#include "FlashLog.h"
 
 UserInterface userInterface;
 
@@ -26,18 +27,26 @@ void setup()
   multiPrint->addPrint(&Serial);
 #endif
 
+  // persisted history, recovers the previous boot's last lines so it runs before the first log
+  Print* flashLog = flashLogBegin();
+  if (flashLog) multiPrint->addPrint(flashLog);
+
   Log.setPrefix(printPrefix);
   Log.setSuffix(printSuffix);
   Log.begin(LOG_LEVEL_VERBOSE, multiPrint);
   Log.setShowLevel(false);
 
+  auto uart0Bridge = new SerialBridge("UART0 Bridge", "uart0", Serial0, 0);
+
 #if !SERIAL_DEBUG
   auto serialBridge = new SerialBridge("USB-Serial Bridge", "serial", Serial);
+  // either side may be set to cross-connect directly to the other
+  serialBridge->setPeer(uart0Bridge);
+  uart0Bridge->setPeer(serialBridge);
   serialBridge->start();
   userInterface.addSerialBridge(*serialBridge);
 #endif
 
-  auto uart0Bridge = new SerialBridge("UART0 Bridge", "uart0", Serial0);
   uart0Bridge->start();
   userInterface.addSerialBridge(*uart0Bridge);
   
@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <unity.h>
+
+#include "Qos.h"
+
+// TokenBucket and QueueDelay as the bridge pump drives them: budgets in input
+// bytes from available(), consume() with what went out on the wire.
+
+void setUp() {}
+void tearDown() {}
+
+void test_unlimited()
+{
+  TokenBucket bucket;
+  bucket.configure(0, 0);
+  TEST_ASSERT_TRUE(bucket.available(0) == SIZE_MAX);
+  bucket.consume(1000000);
+  TEST_ASSERT_TRUE(bucket.available(1) == SIZE_MAX);
+}
+
+void test_refill()
+{
+  // 1000 B/s, the burst is the 512 byte minimum
+  TokenBucket bucket;
+  bucket.configure(1000, 0);
+  TEST_ASSERT_EQUAL_UINT32(512, bucket.available(0));
+  bucket.consume(512);
+  TEST_ASSERT_EQUAL_UINT32(0, bucket.available(0));
+  TEST_ASSERT_EQUAL_UINT32(100, bucket.available(100000));
+  // fractions of a byte carry over between calls
+  bucket.consume(100);
+  for (uint32_t t = 100500; t <= 110000; t += 500) bucket.available(t);
+  TEST_ASSERT_EQUAL_UINT32(10, bucket.available(110000));
+}
+
+void test_burst_cap()
+{
+  // a tenth of a second of data once the rate is high enough
+  TokenBucket bucket;
+  bucket.configure(100000, 0);
+  bucket.consume(10000);
+  TEST_ASSERT_EQUAL_UINT32(10000, bucket.available(10000000));
+
+  bucket.configure(1000, 0);
+  TEST_ASSERT_EQUAL_UINT32(512, bucket.available(60000000));
+}
+
+void test_wraparound()
+{
+  // micros() wraps every 71 minutes, the elapsed time must not
+  uint32_t start = 0xFFFFFF00u;
+  TokenBucket bucket;
+  bucket.configure(1000000, start);
+  bucket.consume(bucket.available(start));
+  TEST_ASSERT_EQUAL_UINT32(0x200, bucket.available(start + 0x200));
+
+  QueueDelay delay;
+  delay.observe(10, start);
+  TEST_ASSERT_EQUAL_UINT32(0x300, delay.sent(10, start + 0x300));
+}
+
+void test_overdraw()
+{
+  // an expanding transform sends more than it was budgeted, the debt is paid first
+  TokenBucket bucket;
+  bucket.configure(1000, 0);
+  size_t budget = bucket.available(0);
+  bucket.consume(budget * 2);
+  TEST_ASSERT_EQUAL_UINT32(0, bucket.available(500000));
+  TEST_ASSERT_EQUAL_UINT32(0, bucket.available(512000));
+  TEST_ASSERT_EQUAL_UINT32(100, bucket.available(612000));
+}
+
+void test_wire_rate_with_expansion()
+{
+  // the pump takes the budget in input bytes and consumes wire bytes, with lf -> crlf
+  // on every byte the wire still runs at the configured rate, give or take one burst
+  static constexpr uint32_t kRate = 10000;
+  static constexpr uint32_t kSeconds = 10;
+  TokenBucket bucket;
+  bucket.configure(kRate, 0);
+
+  uint64_t wire = 0;
+  for (uint32_t t = 0; t <= kSeconds * 1000000; t += 1000) {
+    size_t budget = bucket.available(t);
+    size_t input = budget < 512 ? budget : 512;
+    if (input == 0) continue;
+    bucket.consume(input * 2);
+    wire += input * 2;
+  }
+  uint64_t expected = (uint64_t)kRate * kSeconds;
+  TEST_ASSERT_TRUE(wire >= expected);
+  TEST_ASSERT_TRUE(wire <= expected + 1000 + 2 * 512);
+}
+
+void test_queue_delay()
+{
+  QueueDelay delay;
+  delay.observe(100, 0);
+  delay.observe(200, 1000);
+  // the first 100 bytes were seen at 0, the next 100 at 1000
+  TEST_ASSERT_EQUAL_UINT32(2000, delay.sent(100, 2000));
+  TEST_ASSERT_EQUAL_UINT32(2000, delay.sent(100, 3000));
+  TEST_ASSERT_EQUAL_UINT32(0, delay.sent(10, 4000));
+}
+
+void test_queue_delay_partial()
+{
+  // a send that ends inside an observation is timed by the one that first saw its last byte
+  QueueDelay delay;
+  delay.observe(100, 0);
+  delay.observe(300, 1000);
+  TEST_ASSERT_EQUAL_UINT32(4000, delay.sent(150, 5000));
+  TEST_ASSERT_EQUAL_UINT32(5000, delay.sent(150, 6000));
+}
+
+void test_queue_delay_reset()
+{
+  // input that went away unsent, and an empty input, start over
+  QueueDelay delay;
+  delay.observe(100, 0);
+  delay.observe(50, 1000);
+  TEST_ASSERT_EQUAL_UINT32(1000, delay.sent(50, 2000));
+  delay.observe(0, 3000);
+  delay.observe(20, 4000);
+  TEST_ASSERT_EQUAL_UINT32(500, delay.sent(20, 4500));
+}
+
+void test_queue_delay_marks_run_out()
+{
+  // more observations than marks, the newest absorbs the rest and errs long
+  QueueDelay delay;
+  for (uint32_t i = 1; i <= 20; ++i) delay.observe(i * 10, i * 100);
+  uint32_t last = 0;
+  for (uint32_t i = 1; i <= 20; ++i) last = delay.sent(10, 10000);
+  TEST_ASSERT_TRUE(last >= 10000 - 2000);
+  TEST_ASSERT_TRUE(last <= 10000 - 100);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_unlimited);
+  RUN_TEST(test_refill);
+  RUN_TEST(test_burst_cap);
+  RUN_TEST(test_wraparound);
+  RUN_TEST(test_overdraw);
+  RUN_TEST(test_wire_rate_with_expansion);
+  RUN_TEST(test_queue_delay);
+  RUN_TEST(test_queue_delay_partial);
+  RUN_TEST(test_queue_delay_reset);
+  RUN_TEST(test_queue_delay_marks_run_out);
+  return UNITY_END();
+}
@@ -0,0 +1,97 @@
+#include <string.h>
+#include <vector>
+#include <unity.h>
+
+#include "SelfTest.h"
+
+static constexpr uint32_t kRate = 64000;     // 1000 frames per second
+static constexpr size_t kFrames = 100;
+static constexpr size_t kFrameSize = PrbsTester::kFrameSize;
+
+// runs kFrames frames, lets damage() change the wire bytes and feeds them back
+// in odd sized pieces so frames straddle receive() calls
+template <typename F>
+static SelfTestResults loopback(F damage)
+{
+  PrbsTester tester(kRate);
+  uint32_t now = 1000;
+  tester.begin(now);
+
+  // one frame per millisecond at this rate
+  std::vector<uint8_t> wire;
+  uint8_t buf[kFrameSize];
+  for (size_t i = 0; i < kFrames; ++i) {
+    now += 1000;
+    size_t n = tester.generate(buf, sizeof(buf), now);
+    wire.insert(wire.end(), buf, buf + n);
+  }
+  TEST_ASSERT_EQUAL_UINT32(kFrames * kFrameSize, wire.size());
+  damage(wire);
+
+  for (size_t i = 0; i < wire.size(); i += 37) {
+    size_t n = wire.size() - i < 37 ? wire.size() - i : 37;
+    tester.receive(wire.data() + i, n, now + 500);
+  }
+  return tester.results(now + 1000);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_clean_loopback()
+{
+  SelfTestResults res = loopback([](std::vector<uint8_t>&) {});
+  TEST_ASSERT_EQUAL_UINT32(kFrames, res.framesOk);
+  TEST_ASSERT_EQUAL_UINT32(0, res.framesBad);
+  TEST_ASSERT_EQUAL_UINT32(0, res.syncSlips);
+  TEST_ASSERT_EQUAL_UINT64(0, res.bitErrors);
+  TEST_ASSERT_EQUAL_UINT32(0, res.bytesLost / kFrameSize);
+  TEST_ASSERT_EQUAL_UINT32(kFrames * kFrameSize, res.bytesVerified);
+  TEST_ASSERT_TRUE(res.latencyP50Us > 0);
+}
+
+void test_dropped_byte()
+{
+  // one byte out of a payload, that frame is lost, the next one resyncs
+  SelfTestResults res = loopback([](std::vector<uint8_t>& wire) {
+    wire.erase(wire.begin() + 10 * kFrameSize + 30);
+  });
+  TEST_ASSERT_EQUAL_UINT32(kFrames - 1, res.framesOk);
+  TEST_ASSERT_EQUAL_UINT32(1, res.framesBad);
+  TEST_ASSERT_EQUAL_UINT64(0, res.bitErrors);
+  TEST_ASSERT_EQUAL_UINT32(1, res.bytesLost / kFrameSize);
+}
+
+void test_flipped_bit()
+{
+  // one bit in a payload is scored as a bit error, nothing is lost
+  SelfTestResults res = loopback([](std::vector<uint8_t>& wire) {
+    wire[20 * kFrameSize + PrbsTester::kHeaderSize + 5] ^= 0x10;
+  });
+  TEST_ASSERT_EQUAL_UINT32(kFrames, res.framesOk);
+  TEST_ASSERT_EQUAL_UINT32(0, res.framesBad);
+  TEST_ASSERT_EQUAL_UINT64(1, res.bitErrors);
+  TEST_ASSERT_EQUAL_UINT32(0, res.bytesLost / kFrameSize);
+}
+
+void test_damaged_header()
+{
+  // a bad header crc drops just that frame
+  SelfTestResults res = loopback([](std::vector<uint8_t>& wire) {
+    wire[30 * kFrameSize + 3] ^= 0x01;
+  });
+  TEST_ASSERT_EQUAL_UINT32(kFrames - 1, res.framesOk);
+  TEST_ASSERT_EQUAL_UINT32(1, res.framesBad);
+  TEST_ASSERT_EQUAL_UINT64(0, res.bitErrors);
+  TEST_ASSERT_EQUAL_UINT32(1, res.bytesLost / kFrameSize);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_loopback);
+  RUN_TEST(test_dropped_byte);
+  RUN_TEST(test_flipped_bit);
+  RUN_TEST(test_damaged_header);
+  return UNITY_END();
+}
@@ -0,0 +1,135 @@
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <unity.h>
+
+#include "ByteTransform.h"
+
+// Checks ByteTransform against a byte at a time reference for every flag
+// combination, then times apply() on typical traffic. Run with
+// pio test -e native -f test_transform_bench -v to see the numbers.
+
+static constexpr size_t kBufSize = 512;       // the bridge pump buffer
+static constexpr size_t kBenchBytes = 64u << 20;
+
+static size_t reference(uint8_t flags, const uint8_t* in, size_t len, uint8_t* out)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t b = in[i];
+    if (flags & ByteTransform::MASK_7BIT) b &= 0x7F;
+    if ((flags & ByteTransform::STRIP_CONTROL) && (b < 0x20 || b > 0x7E) && b != '\t' && b != '\r' && b != '\n') continue;
+    if ((flags & ByteTransform::CRLF_TO_LF) && b == '\r') continue;
+    if ((flags & ByteTransform::LF_TO_CRLF) && b == '\n') out[n++] = '\r';
+    if ((flags & ByteTransform::DLE_ESCAPE) && b == 0x10) out[n++] = 0x10;
+    out[n++] = b;
+  }
+  return n;
+}
+
+static uint32_t g_seed = 1;
+static uint8_t nextByte()
+{
+  g_seed = g_seed * 1664525u + 1013904223u;
+  return (uint8_t)(g_seed >> 24);
+}
+
+// mostly printable text with line ends, the odd control and high byte
+static void fillText(uint8_t* buf, size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t r = nextByte();
+    if (r < 8) buf[i] = '\n';
+    else if (r < 12) buf[i] = '\r';
+    else if (r < 14) buf[i] = 0x10;
+    else if (r < 16) buf[i] = 0x80 | nextByte();
+    else buf[i] = (uint8_t)(0x20 + r % 0x5F);
+  }
+}
+
+// runs the pump's pattern: raw input at the tail of the buffer, apply() in place
+static size_t pump(const ByteTransform& xf, const uint8_t* in, size_t len, uint8_t* buf)
+{
+  size_t offset = xf.inputOffset(kBufSize);
+  memcpy(buf + offset, in, len);
+  return xf.apply(buf, offset, len);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_matches_reference()
+{
+  uint8_t in[kBufSize];
+  uint8_t buf[kBufSize];
+  uint8_t expected[kBufSize * 3];
+
+  for (uint8_t flags = 0; flags <= ByteTransform::ALL; ++flags) {
+    ByteTransform xf;
+    xf.configure(flags);
+    size_t cap = xf.inputCap(kBufSize);
+    for (int round = 0; round < 200; ++round) {
+      size_t len = 1 + nextByte() % cap;
+      if (round & 1) fillText(in, len);
+      else for (size_t i = 0; i < len; ++i) in[i] = nextByte();
+
+      size_t n = pump(xf, in, len, buf);
+      size_t want = reference(flags, in, len, expected);
+      TEST_ASSERT_EQUAL_UINT32(want, n);
+      TEST_ASSERT_EQUAL_MEMORY(expected, buf, n);
+    }
+  }
+}
+
+static double bench(uint8_t flags, const std::vector<uint8_t>& data)
+{
+  ByteTransform xf;
+  xf.configure(flags);
+  size_t chunk = xf.inputCap(kBufSize);
+  uint8_t buf[kBufSize];
+  size_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t done = 0; done < kBenchBytes; done += chunk) {
+    size_t at = done % (data.size() - chunk);
+    sink += pump(xf, data.data() + at, chunk, buf);
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_TRUE(sink > 0);
+  return kBenchBytes / secs / 1e6;
+}
+
+void test_throughput()
+{
+  std::vector<uint8_t> text(1u << 20);
+  fillText(text.data(), text.size());
+  // plain printable text, what the fast path is for
+  std::vector<uint8_t> printable(text);
+  for (uint8_t& b : printable) if (b < 0x20 || b > 0x7E) b = 'x';
+
+  static const struct { uint8_t flags; const char* name; } kCases[] = {
+    { 0, "identity" },
+    { ByteTransform::MASK_7BIT, "mask 7 bit" },
+    { ByteTransform::STRIP_CONTROL, "strip control" },
+    { ByteTransform::CRLF_TO_LF, "crlf to lf" },
+    { ByteTransform::LF_TO_CRLF, "lf to crlf" },
+    { ByteTransform::DLE_ESCAPE, "dle escape" },
+    { ByteTransform::ALL, "all" },
+  };
+
+  char line[96];
+  for (const auto& c : kCases) {
+    snprintf(line, sizeof(line), "%-14s text %8.1f MB/s, printable %8.1f MB/s",
+      c.name, bench(c.flags, text), bench(c.flags, printable));
+    TEST_MESSAGE(line);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_matches_reference);
+  RUN_TEST(test_throughput);
+  return UNITY_END();
+}
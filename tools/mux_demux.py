@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""Host side demultiplexer for the serial bridge mux server.
+
+Connects to a device's mux port and exposes every channel it announces as a
+local TCP port (base port + channel number), so existing tools can keep
+talking to one socket per serial port.
+
+    python3 tools/mux_demux.py 192.168.1.50 --port 3300 --base-port 4000
+
+See src/MuxServer.h for the frame format.
+"""
+
+import argparse
+import asyncio
+import struct
+
+FLAG_DATA = 0x00
+FLAG_CREDIT = 0x01
+FLAG_OPEN = 0x02
+FLAG_CLOSE = 0x03
+
+MAX_PAYLOAD = 512
+WINDOW = 2048
+
+
+class Channel:
+    def __init__(self, mux, chan, code):
+        self.mux = mux
+        self.chan = chan
+        self.code = code
+        self.writer = None
+        self.server = None
+        # bytes we may still send to the device on this channel
+        self.credit = WINDOW
+        self.credit_event = asyncio.Event()
+        self.credit_event.set()
+        # device data waiting for the local client, credit bounds it to WINDOW
+        self.queue = asyncio.Queue()
+        # bytes written to the local client, not yet granted back
+        self.owed = 0
+        # bumped when the device opens the channel again, older queued data earns no credit
+        self.session = 0
+        self.drainer = None
+        self.closed = False
+
+    async def listen(self, base_port):
+        port = base_port + self.chan
+        self.server = await asyncio.start_server(self.on_client, "127.0.0.1", port)
+        self.drainer = asyncio.create_task(self.drain())
+        print(f"channel {self.chan} ({self.code}) on 127.0.0.1:{port}")
+
+    def reopen(self, code):
+        # the device starts the channel over with a full window each way
+        self.code = code
+        self.session += 1
+        self.owed = 0
+        self.credit = WINDOW
+        self.credit_event.set()
+        print(f"channel {self.chan} ({self.code}) reopened")
+
+    def close(self):
+        # the device detached the bridge, nothing more is sent or accepted on the channel
+        self.closed = True
+        self.credit_event.set()
+        if self.server is not None:
+            self.server.close()
+        if self.drainer is not None:
+            self.drainer.cancel()
+        if self.writer is not None:
+            self.writer.close()
+        print(f"channel {self.chan} ({self.code}) closed")
+
+    async def on_client(self, reader, writer):
+        if self.writer is not None or self.closed:
+            # one client per channel, like the single client tcp bridges
+            writer.close()
+            return
+        self.writer = writer
+        try:
+            while True:
+                await self.credit_event.wait()
+                if self.closed:
+                    break
+                data = await reader.read(min(MAX_PAYLOAD, self.credit))
+                if not data or self.closed:
+                    break
+                self.credit -= len(data)
+                if self.credit == 0:
+                    self.credit_event.clear()
+                await self.mux.send(self.chan, FLAG_DATA, data)
+        finally:
+            if self.writer is writer:
+                self.writer = None
+            writer.close()
+
+    def on_data(self, data):
+        # never waits, a slow local client must not stall the other channels
+        self.queue.put_nowait((self.session, data))
+
+    async def drain(self):
+        while True:
+            session, data = await self.queue.get()
+            # data without a local client is dropped, credit is still returned
+            writer = self.writer
+            if writer is not None:
+                try:
+                    writer.write(data)
+                    await writer.drain()
+                except ConnectionError:
+                    pass
+            if session != self.session:
+                continue
+            self.owed += len(data)
+            if self.owed >= WINDOW // 4:
+                owed, self.owed = self.owed, 0
+                await self.mux.send(self.chan, FLAG_CREDIT, struct.pack("<H", owed))
+
+    def on_credit(self, credit):
+        self.credit += credit
+        self.credit_event.set()
+
+
+class Mux:
+    def __init__(self, base_port):
+        self.base_port = base_port
+        self.channels = {}
+        self.writer = None
+        self.lock = asyncio.Lock()
+
+    async def send(self, chan, flags, payload):
+        async with self.lock:
+            self.writer.write(struct.pack("<BBH", chan, flags, len(payload)) + payload)
+            await self.writer.drain()
+
+    async def run(self, host, port):
+        reader, self.writer = await asyncio.open_connection(host, port)
+        print(f"connected to {host}:{port}")
+        while True:
+            chan, flags, length = struct.unpack("<BBH", await reader.readexactly(4))
+            payload = await reader.readexactly(length) if length else b""
+
+            if flags == FLAG_OPEN:
+                code = payload.decode(errors="replace")
+                if chan in self.channels:
+                    self.channels[chan].reopen(code)
+                else:
+                    ch = Channel(self, chan, code)
+                    self.channels[chan] = ch
+                    await ch.listen(self.base_port)
+                continue
+
+            if flags == FLAG_CLOSE:
+                # a later OPEN on the same number starts a fresh channel
+                ch = self.channels.pop(chan, None)
+                if ch is not None:
+                    ch.close()
+                continue
+
+            ch = self.channels.get(chan)
+            if ch is None:
+                continue
+            if flags == FLAG_DATA:
+                ch.on_data(payload)
+            elif flags == FLAG_CREDIT and length == 2:
+                ch.on_credit(struct.unpack("<H", payload)[0])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host", help="device address")
+    parser.add_argument("--port", type=int, default=3300, help="device mux port")
+    parser.add_argument("--base-port", type=int, default=4000, help="first local port, channel N listens on base + N")
+    args = parser.parse_args()
+
+    try:
+        asyncio.run(Mux(args.base_port).run(args.host, args.port))
+    except (asyncio.IncompleteReadError, ConnectionError):
+        print("device disconnected")
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()